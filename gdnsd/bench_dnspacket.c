@@ -0,0 +1,168 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Microbenchmark for the response-encoding path of dnspacket.c, mostly
+ *  aimed at domainname compression (store_dname()) in responses which
+ *  store many names.  It builds a synthetic zone directly in the ltree
+ *  (standing in for the zonefile scanner), then times process_dns_query()
+ *  for a few query types against it.  Not built by default:
+ *
+ *    make -C gdnsd bench_dnspacket && ./gdnsd/bench_dnspacket [names [iterations]]
+ *
+ * "names" (default 64, max 200) is the number of targets in each of the
+ *  big rrsets.
+ */
+
+#include "config.h"
+#include "gdnsd.h"
+#include "conf.h"
+#include "ltree.h"
+#include "zscan.h"
+#include "dnspacket.h"
+#include "dnswire.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+global_config_t gconfig;
+
+static unsigned num_names = 64;
+
+F_NONNULL
+static const uint8_t* mkdname(const char* fmt, const unsigned n) {
+    char str[256];
+    snprintf(str, 256, fmt, n);
+    uint8_t* dname = malloc(256);
+    if(gdnsd_dname_from_string(dname, (const uint8_t*)str, strlen(str)) != DNAME_VALID)
+        log_fatal("bench: bad name '%s'", str);
+    return dname;
+}
+
+// Stands in for the zonefile scanner, called from ltree_load_zones().
+//  The big rrsets are:
+//   MX at the apex, each target in its own subdomain, with in-zone addresses
+//    as additionals (partial compression against each other)
+//   PTR at ptr.example.com, each target in a different external domain
+//    (no compression beyond the TLD, i.e. mostly misses)
+//   NS at sub.example.com, all names sharing the delegation as a suffix,
+//    with glue
+void scan_zone(const zoneinfo_t* zone V_UNUSED) {
+    const uint8_t* apex = mkdname("example.com.", 0);
+    ltree_add_rec_soa(apex, mkdname("ns1.example.com.", 0), mkdname("hostmaster.example.com.", 0), 86400, 1, 7200, 1800, 259200, 900);
+    ltree_add_rec_ns(apex, mkdname("ns1.example.com.", 0), 86400);
+    ltree_add_rec_ns(apex, mkdname("ns2.example.com.", 0), 86400);
+    ltree_add_rec_a(mkdname("ns1.example.com.", 0), htonl(0xC0000201), 86400, 0, NULL);
+    ltree_add_rec_a(mkdname("ns2.example.com.", 0), htonl(0xC0000202), 86400, 0, NULL);
+    ltree_add_rec_a(mkdname("www.example.com.", 0), htonl(0xC0000203), 86400, 0, NULL);
+
+    const uint8_t* ptr = mkdname("ptr.example.com.", 0);
+    const uint8_t* sub = mkdname("sub.example.com.", 0);
+    for(unsigned i = 0; i < num_names; i++) {
+        const uint8_t* mx = mkdname("mail.mx%u.example.com.", i);
+        ltree_add_rec_mx(apex, mx, 86400, i);
+        ltree_add_rec_a(mx, htonl(0xC6120000 + i), 86400, 0, NULL);
+        ltree_add_rec_ptr(ptr, mkdname("host.example%u.net.", i), 86400);
+        const uint8_t* ns = mkdname("ns%u.sub.example.com.", i);
+        ltree_add_rec_ns(sub, ns, 86400);
+        ltree_add_rec_a(ns, htonl(0xC6130000 + i), 86400, 0, NULL);
+    }
+}
+
+// A query with an EDNS OPT RR allowing the largest responses
+F_NONNULL
+static unsigned mkquery(uint8_t* pkt, const char* name, const unsigned qtype) {
+    memset(pkt, 0, sizeof(wire_dns_header_t));
+    pkt[5] = 1; // qdcount
+    pkt[11] = 1; // arcount
+    unsigned pos = sizeof(wire_dns_header_t);
+    const uint8_t* dname = mkdname(name, 0);
+    memcpy(&pkt[pos], dname + 1, *dname);
+    pos += *dname;
+    *((uint16_t*)&pkt[pos]) = htons(qtype); pos += 2;
+    *((uint16_t*)&pkt[pos]) = htons(DNS_CLASS_IN); pos += 2;
+    static const uint8_t optrr[] = { 0, 0, 41, 0xFF, 0xFF, 0, 0, 0, 0, 0, 0 };
+    memcpy(&pkt[pos], optrr, sizeof(optrr));
+    return pos + sizeof(optrr);
+}
+
+int main(int argc, char* argv[]) {
+    unsigned iterations = 200000;
+    if(argc > 1)
+        num_names = (unsigned)atoi(argv[1]);
+    if(argc > 2)
+        iterations = (unsigned)atoi(argv[2]);
+    if(!num_names || num_names > 200 || !iterations) {
+        fprintf(stderr, "Usage: %s [names (1-200) [iterations]]\n", argv[0]);
+        exit(2);
+    }
+
+    dmn_init_log();
+
+    zoneinfo_t zone = { .dname = mkdname("example.com.", 0), .subzones = NULL };
+    gconfig.zones = &zone;
+    gconfig.num_zones = 1;
+    gconfig.num_io_threads = 1;
+    gconfig.max_response = 64000U;
+    gconfig.max_cname_depth = 16U;
+    gconfig.max_addtl_rrsets = 256U;
+    gconfig.include_optional_ns = true;
+    ltree_load_zones();
+
+    dnspacket_global_setup();
+    dnspacket_context_t* ctx = dnspacket_context_new(0, false);
+
+    anysin_t asin;
+    memset(&asin, 0, sizeof(asin));
+    asin.sin.sin_family = AF_INET;
+    asin.sin.sin_addr.s_addr = htonl(0xC0000263);
+    asin.len = sizeof(struct sockaddr_in);
+
+    static const struct {
+        const char* desc;
+        const char* name;
+        unsigned qtype;
+    } cases[] = {
+        { "A, one small answer", "www.example.com.", DNS_TYPE_A },
+        { "MX, in-zone targets + addresses", "example.com.", DNS_TYPE_MX },
+        { "PTR, external targets", "ptr.example.com.", DNS_TYPE_PTR },
+        { "delegation, NS + glue", "foo.sub.example.com.", DNS_TYPE_A },
+    };
+
+    uint8_t* query = malloc(512);
+    uint8_t* packet = malloc(gconfig.max_response);
+    printf("%u names per big rrset, %u iterations per case\n", num_names, iterations);
+    for(unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const unsigned qlen = mkquery(query, cases[i].name, cases[i].qtype);
+        unsigned rlen = 0;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(unsigned j = 0; j < iterations; j++) {
+            memcpy(packet, query, qlen);
+            rlen = process_dns_query(ctx, &asin, packet, qlen);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / iterations;
+        printf("%-34s %6u bytes %10.1f ns/query\n", cases[i].desc, rlen, ns);
+    }
+
+    return 0;
+}
@@ -21,6 +21,7 @@
 #include "monio.h"
 #include "dnsio_udp.h"
 #include "dnsio_tcp.h"
+#include "handoff.h"
 #include "gdnsd-misc.h"
 #include "gdnsd-misc-priv.h"
 #include "gdnsd-plugapi-priv.h"
@@ -51,6 +52,7 @@ static const char def_chroot_path[] = VARDIR "/" PACKAGE_NAME;
 global_config_t gconfig = {
     .zones = NULL,
     .dns_addrs = NULL,
+    .dns_threads = NULL,
     .http_addrs = NULL,
     .pidfile = def_pidfile,
     .username = def_username,
@@ -62,6 +64,9 @@ global_config_t gconfig = {
     .strict_data = true,
     .edns_client_subnet = true,
     .monitor_force_v6_up = false,
+    .udp_latency_stats = false,
+    .restart_handoff = false,
+    .preencode_answers = false,
      // legal values are -20 to 20, so -21
      //  is really just an indicator that the user
      //  didn't explicitly set it.  The default
@@ -74,9 +79,22 @@ global_config_t gconfig = {
     .num_zones = 0U,
     .num_dns_addrs = 0U,
     .num_http_addrs = 0U,
+    .num_dns_threads = 0U,
+    .num_io_threads = 0U,
+    .udp_pool_threads = 0U,
+    .num_thread_cpus = 0U,
+    .thread_cpus = NULL,
     .max_response = 16384U,
     .max_cname_depth = 16U,
-    .max_addtl_rrsets = 64U
+    .max_addtl_rrsets = 64U,
+    .rrl_responses_per_sec = 0U,
+    .rrl_slip = 2U,
+    .rrl_ipv4_prefix_len = 24U,
+    .rrl_ipv6_prefix_len = 56U,
+    .rrl_table_size = 65536U,
+    .response_cache_size = 0U,
+    .dynamic_cache_size = 0U,
+    .dynamic_cache_secs = 5U
 };
 
 bool skip_plugins_cleanup = false;
@@ -432,7 +450,48 @@ static bool dns_addr_is_dupe(const anysin_t* new_addr) {
     return false;
 }
 
-static void process_listen(const vscf_data_t* listen_opt, const unsigned def_dns_port, const unsigned def_tcp_cps, const unsigned def_tcp_to, const bool def_tcp_disabled, const unsigned def_udp_recv_width, const unsigned def_udp_rcvbuf, const unsigned def_udp_sndbuf, const unsigned def_late_bind_secs) {
+F_NONNULL
+static udp_steer_t parse_udp_steer(const char* steer, const char* where) {
+    dmn_assert(steer); dmn_assert(where);
+    if(!strcmp(steer, "none"))
+        return UDP_STEER_NONE;
+    if(!strcmp(steer, "client"))
+        return UDP_STEER_CLIENT;
+    if(!strcmp(steer, "cpu"))
+        return UDP_STEER_CPU;
+    log_fatal("%s: udp_reuseport_steer must be one of 'none', 'client', or 'cpu' (got '%s')", where, steer);
+}
+
+// Parses thread_cpus, which is a single CPU number or an array of them
+F_NONNULL
+static unsigned parse_thread_cpus(const vscf_data_t* opt, const char* where, unsigned** cpus_out) {
+    dmn_assert(opt); dmn_assert(where); dmn_assert(cpus_out);
+
+#ifndef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+    log_fatal("%s: thread_cpus is not supported on this platform", where);
+#endif
+
+    const unsigned count = vscf_array_get_len(opt);
+    if(!count)
+        log_fatal("%s: thread_cpus must list at least one CPU", where);
+
+    const long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    unsigned* cpus = malloc(count * sizeof(unsigned));
+    for(unsigned i = 0; i < count; i++) {
+        const vscf_data_t* cpu = vscf_array_get_data(opt, i);
+        unsigned long val;
+        if(!vscf_is_simple(cpu) || !vscf_simple_get_as_ulong(cpu, &val))
+            log_fatal("%s: thread_cpus values must be CPU numbers", where);
+        if(ncpus > 0 && val >= (unsigned long)ncpus)
+            log_fatal("%s: thread_cpus value %lu is out of range, this system has %li CPUs", where, val, ncpus);
+        cpus[i] = (unsigned)val;
+    }
+
+    *cpus_out = cpus;
+    return count;
+}
+
+static void process_listen(const vscf_data_t* listen_opt, const unsigned def_dns_port, const unsigned def_tcp_cps, const unsigned def_tcp_to, const bool def_tcp_disabled, const unsigned def_udp_recv_width, const unsigned def_udp_recv_width_min, const unsigned def_udp_rcvbuf, const unsigned def_udp_sndbuf, const unsigned def_udp_threads, const unsigned def_tcp_threads, const unsigned def_tcp_fastopen_qlen, const bool def_udp_io_uring, const udp_steer_t def_udp_steer, const unsigned def_udp_busy_poll_usecs, const unsigned def_late_bind_secs) {
 
     anysin_t temp_asin;
 
@@ -479,9 +538,18 @@ static void process_listen(const vscf_data_t* listen_opt, const unsigned def_dns
             addrconf->tcp_timeout = def_tcp_to;
             addrconf->tcp_disabled = def_tcp_disabled;
             addrconf->udp_recv_width = def_udp_recv_width;
+            addrconf->udp_recv_width_min = def_udp_recv_width_min;
             addrconf->udp_rcvbuf = def_udp_rcvbuf;
             addrconf->udp_sndbuf = def_udp_sndbuf;
+            addrconf->udp_threads = def_udp_threads;
+            addrconf->tcp_threads = def_tcp_threads;
+            addrconf->tcp_fastopen_qlen = def_tcp_fastopen_qlen;
+            addrconf->udp_io_uring = def_udp_io_uring;
+            addrconf->udp_reuseport_steer = def_udp_steer;
+            addrconf->udp_busy_poll_usecs = def_udp_busy_poll_usecs;
             addrconf->late_bind_secs = def_late_bind_secs;
+            addrconf->num_thread_cpus = gconfig.num_thread_cpus;
+            addrconf->thread_cpus = gconfig.thread_cpus;
             dmn_log_info("DNS listener configured by default for %s", logf_anysin(&addrconf->addr));
         }
 
@@ -500,8 +568,17 @@ static void process_listen(const vscf_data_t* listen_opt, const unsigned def_dns
                 addrconf->tcp_timeout = def_tcp_to;
                 addrconf->tcp_disabled = def_tcp_disabled;
                 addrconf->udp_recv_width = def_udp_recv_width;
+                addrconf->udp_recv_width_min = def_udp_recv_width_min;
                 addrconf->udp_rcvbuf = def_udp_rcvbuf;
                 addrconf->udp_sndbuf = def_udp_sndbuf;
+                addrconf->udp_threads = def_udp_threads;
+                addrconf->tcp_threads = def_tcp_threads;
+                addrconf->tcp_fastopen_qlen = def_tcp_fastopen_qlen;
+                addrconf->udp_io_uring = def_udp_io_uring;
+                addrconf->udp_reuseport_steer = def_udp_steer;
+                addrconf->udp_busy_poll_usecs = def_udp_busy_poll_usecs;
+                addrconf->num_thread_cpus = gconfig.num_thread_cpus;
+                addrconf->thread_cpus = gconfig.thread_cpus;
                 const char* lspec = vscf_hash_get_key_byindex(listen_opt, i, NULL);
                 const vscf_data_t* addr_opts = vscf_hash_get_data_byindex(listen_opt, i);
                 if(!vscf_is_hash(addr_opts))
@@ -511,9 +588,25 @@ static void process_listen(const vscf_data_t* listen_opt, const unsigned def_dns
                 CFG_OPT_UINT_ALTSTORE(addr_opts, tcp_timeout, 3LU, 60LU, addrconf->tcp_timeout);
                 CFG_OPT_BOOL_ALTSTORE(addr_opts, disable_tcp, addrconf->tcp_disabled);
                 CFG_OPT_UINT_ALTSTORE(addr_opts, udp_recv_width, 1LU, 32LU, addrconf->udp_recv_width);
+                CFG_OPT_UINT_ALTSTORE_0MIN(addr_opts, udp_recv_width_min, 64LU, addrconf->udp_recv_width_min);
                 CFG_OPT_UINT_ALTSTORE(addr_opts, udp_rcvbuf, 4096LU, 1048576LU, addrconf->udp_rcvbuf);
                 CFG_OPT_UINT_ALTSTORE(addr_opts, udp_sndbuf, 4096LU, 1048576LU, addrconf->udp_sndbuf);
+                CFG_OPT_UINT_ALTSTORE(addr_opts, udp_threads, 1LU, 1024LU, addrconf->udp_threads);
+                CFG_OPT_UINT_ALTSTORE_0MIN(addr_opts, udp_busy_poll_usecs, 100000LU, addrconf->udp_busy_poll_usecs);
+                CFG_OPT_UINT_ALTSTORE(addr_opts, tcp_threads, 1LU, 1024LU, addrconf->tcp_threads);
+                CFG_OPT_UINT_ALTSTORE_0MIN(addr_opts, tcp_fastopen_qlen, 65535LU, addrconf->tcp_fastopen_qlen);
+                CFG_OPT_BOOL_ALTSTORE(addr_opts, udp_io_uring, addrconf->udp_io_uring);
+                const char* steer = NULL;
+                CFG_OPT_STR_NOCOPY(addr_opts, udp_reuseport_steer, steer);
+                if(steer)
+                    addrconf->udp_reuseport_steer = parse_udp_steer(steer, lspec);
                 CFG_OPT_UINT_ALTSTORE_0MIN(addr_opts, late_bind_secs, 300LU, addrconf->late_bind_secs);
+                const vscf_data_t* cpus_opt = vscf_hash_get_data_byconstkey(addr_opts, "thread_cpus", true);
+                if(cpus_opt) {
+                    unsigned* cpus;
+                    addrconf->num_thread_cpus = parse_thread_cpus(cpus_opt, lspec, &cpus);
+                    addrconf->thread_cpus = cpus;
+                }
                 make_addr(lspec, def_dns_port, &addrconf->addr);
                 vscf_hash_iterate(addr_opts, true, bad_key, (void*)"per-address listen option");
                 dmn_log_info("DNS listener configured for %s", logf_anysin(&addrconf->addr));
@@ -528,9 +621,18 @@ static void process_listen(const vscf_data_t* listen_opt, const unsigned def_dns
                 addrconf->tcp_timeout = def_tcp_to;
                 addrconf->tcp_disabled = def_tcp_disabled;
                 addrconf->udp_recv_width = def_udp_recv_width;
+                addrconf->udp_recv_width_min = def_udp_recv_width_min;
                 addrconf->udp_rcvbuf = def_udp_rcvbuf;
                 addrconf->udp_sndbuf = def_udp_sndbuf;
+                addrconf->udp_threads = def_udp_threads;
+                addrconf->tcp_threads = def_tcp_threads;
+                addrconf->tcp_fastopen_qlen = def_tcp_fastopen_qlen;
+                addrconf->udp_io_uring = def_udp_io_uring;
+                addrconf->udp_reuseport_steer = def_udp_steer;
+                addrconf->udp_busy_poll_usecs = def_udp_busy_poll_usecs;
                 addrconf->late_bind_secs = def_late_bind_secs;
+                addrconf->num_thread_cpus = gconfig.num_thread_cpus;
+                addrconf->thread_cpus = gconfig.thread_cpus;
                 const vscf_data_t* lspec = vscf_array_get_data(listen_opt, i);
                 if(!vscf_is_simple(lspec))
                     log_fatal("Config option 'listen': all listen specs must be strings");
@@ -542,17 +644,60 @@ static void process_listen(const vscf_data_t* listen_opt, const unsigned def_dns
 }
 
 static void assign_thread_nums(void) {
-    unsigned tnum = 0;
+    unsigned udp_socks = 0;
+    unsigned tcp_socks = 0;
     unsigned addr_ct = gconfig.num_dns_addrs;
 
-    for(unsigned i = 0; i < addr_ct; i++)
-        gconfig.dns_addrs[i].udp_threadnum = tnum++;
-
-    for(unsigned i = 0; i < addr_ct; i++)
+    for(unsigned i = 0; i < addr_ct; i++) {
+        udp_socks += gconfig.dns_addrs[i].udp_threads;
         if(!gconfig.dns_addrs[i].tcp_disabled)
-            gconfig.dns_addrs[i].tcp_threadnum = tnum++;
+            tcp_socks += gconfig.dns_addrs[i].tcp_threads;
+    }
 
-    gconfig.num_io_threads = tnum;
+    // More pool workers than UDP sockets would leave some idle forever
+    if(gconfig.udp_pool_threads > udp_socks)
+        gconfig.udp_pool_threads = udp_socks;
+
+    const unsigned udp_pool = gconfig.udp_pool_threads;
+    const unsigned udp_io_threads = udp_pool ? udp_pool : udp_socks;
+
+    gconfig.num_dns_threads = udp_socks + tcp_socks;
+    gconfig.num_io_threads = udp_io_threads + tcp_socks;
+    gconfig.dns_threads = calloc(gconfig.num_dns_threads, sizeof(dns_thread_t));
+
+    // UDP threads get the low thread numbers, followed by TCP.  In
+    //  pool mode, UDP sockets are dealt round-robin to the pool workers.
+    unsigned sidx = 0;
+    for(unsigned i = 0; i < addr_ct; i++) {
+        for(unsigned j = 0; j < gconfig.dns_addrs[i].udp_threads; j++) {
+            dns_thread_t* t = &gconfig.dns_threads[sidx];
+            t->ac = &gconfig.dns_addrs[i];
+            t->threadnum = udp_pool ? sidx % udp_pool : sidx;
+            t->is_udp = true;
+            // Pool workers are pinned according to the global thread_cpus
+            if(udp_pool)
+                t->cpu = gconfig.num_thread_cpus ? (int)gconfig.thread_cpus[t->threadnum % gconfig.num_thread_cpus] : -1;
+            else
+                t->cpu = t->ac->num_thread_cpus ? (int)t->ac->thread_cpus[j % t->ac->num_thread_cpus] : -1;
+            sidx++;
+        }
+    }
+
+    unsigned tnum = udp_io_threads;
+    for(unsigned i = 0; i < addr_ct; i++) {
+        if(gconfig.dns_addrs[i].tcp_disabled)
+            continue;
+        for(unsigned j = 0; j < gconfig.dns_addrs[i].tcp_threads; j++) {
+            dns_thread_t* t = &gconfig.dns_threads[sidx++];
+            t->ac = &gconfig.dns_addrs[i];
+            t->threadnum = tnum++;
+            t->is_udp = false;
+            t->cpu = t->ac->num_thread_cpus ? (int)t->ac->thread_cpus[j % t->ac->num_thread_cpus] : -1;
+        }
+    }
+
+    dmn_assert(sidx == gconfig.num_dns_threads);
+    dmn_assert(tnum == gconfig.num_io_threads);
 }
 
 void conf_load(const char* cfg_file) {
@@ -587,8 +732,15 @@ void conf_load(const char* cfg_file) {
     unsigned def_tcp_cps = 128U;
     unsigned def_tcp_to = 5U;
     unsigned def_udp_recv_width = 8U;
+    unsigned def_udp_recv_width_min = 0U;
     unsigned def_udp_rcvbuf = 0U;
     unsigned def_udp_sndbuf = 0U;
+    unsigned def_udp_threads = 1U;
+    unsigned def_tcp_threads = 1U;
+    unsigned def_tcp_fastopen_qlen = 0U;
+    bool def_udp_io_uring = false;
+    udp_steer_t def_udp_steer = UDP_STEER_NONE;
+    unsigned def_udp_busy_poll_usecs = 0U;
     unsigned def_late_bind_secs = 0U;
     bool def_tcp_disabled = false;
     bool debug_tmp = false;
@@ -614,8 +766,25 @@ void conf_load(const char* cfg_file) {
         CFG_OPT_UINT_ALTSTORE(options, tcp_timeout, 3LU, 60LU, def_tcp_to);
         CFG_OPT_BOOL_ALTSTORE(options, disable_tcp, def_tcp_disabled);
         CFG_OPT_UINT_ALTSTORE(options, udp_recv_width, 1LU, 64LU, def_udp_recv_width);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, udp_recv_width_min, 64LU, def_udp_recv_width_min);
         CFG_OPT_UINT_ALTSTORE(options, udp_rcvbuf, 4096LU, 1048576LU, def_udp_rcvbuf);
         CFG_OPT_UINT_ALTSTORE(options, udp_sndbuf, 4096LU, 1048576LU, def_udp_sndbuf);
+        CFG_OPT_UINT_ALTSTORE(options, udp_threads, 1LU, 1024LU, def_udp_threads);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, udp_busy_poll_usecs, 100000LU, def_udp_busy_poll_usecs);
+        CFG_OPT_UINT_ALTSTORE(options, tcp_threads, 1LU, 1024LU, def_tcp_threads);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, tcp_fastopen_qlen, 65535LU, def_tcp_fastopen_qlen);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, udp_pool_threads, 1024LU, gconfig.udp_pool_threads);
+        CFG_OPT_BOOL_ALTSTORE(options, udp_io_uring, def_udp_io_uring);
+        CFG_OPT_BOOL(options, udp_latency_stats);
+        CFG_OPT_BOOL(options, restart_handoff);
+        CFG_OPT_BOOL(options, preencode_answers);
+        const char* steer = NULL;
+        CFG_OPT_STR_NOCOPY(options, udp_reuseport_steer, steer);
+        if(steer)
+            def_udp_steer = parse_udp_steer(steer, "options");
+        const vscf_data_t* cpus_opt = vscf_hash_get_data_byconstkey(options, "thread_cpus", true);
+        if(cpus_opt)
+            gconfig.num_thread_cpus = parse_thread_cpus(cpus_opt, "options", &gconfig.thread_cpus);
         CFG_OPT_UINT_ALTSTORE(options, dns_port, 1LU, 65535LU, def_dns_port);
         CFG_OPT_UINT_ALTSTORE(options, http_port, 1LU, 65535LU, def_http_port);
         CFG_OPT_UINT(options, zones_default_ttl, 1LU, 2147483647LU);
@@ -625,6 +794,14 @@ void conf_load(const char* cfg_file) {
         // Nobody should have even the default 16-depth CNAMEs anyways :P
         CFG_OPT_UINT(options, max_cname_depth, 4LU, 24LU);
         CFG_OPT_UINT(options, max_addtl_rrsets, 16LU, 256LU);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, rrl_responses_per_sec, 1000000LU, gconfig.rrl_responses_per_sec);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, rrl_slip, 10LU, gconfig.rrl_slip);
+        CFG_OPT_UINT(options, rrl_ipv4_prefix_len, 8LU, 32LU);
+        CFG_OPT_UINT(options, rrl_ipv6_prefix_len, 16LU, 128LU);
+        CFG_OPT_UINT(options, rrl_table_size, 256LU, 16777216LU);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, response_cache_size, 1048576LU, gconfig.response_cache_size);
+        CFG_OPT_UINT_ALTSTORE_0MIN(options, dynamic_cache_size, 1048576LU, gconfig.dynamic_cache_size);
+        CFG_OPT_UINT(options, dynamic_cache_secs, 1LU, 300LU);
         CFG_OPT_STR(options, pidfile);
         CFG_OPT_STR(options, username);
         CFG_OPT_STR(options, chroot_path);
@@ -642,7 +819,13 @@ void conf_load(const char* cfg_file) {
     process_http_listen(http_listen_opt, def_http_port);
 
     // Initial setup of the listener data, modding the per-key num_socks as it goes and referencing them in the dnsaddr_t's
-    process_listen(listen_opt, def_dns_port, def_tcp_cps, def_tcp_to, def_tcp_disabled, def_udp_recv_width, def_udp_rcvbuf, def_udp_sndbuf, def_late_bind_secs);
+    process_listen(listen_opt, def_dns_port, def_tcp_cps, def_tcp_to, def_tcp_disabled, def_udp_recv_width, def_udp_recv_width_min, def_udp_rcvbuf, def_udp_sndbuf, def_udp_threads, def_tcp_threads, def_tcp_fastopen_qlen, def_udp_io_uring, def_udp_steer, def_udp_busy_poll_usecs, def_late_bind_secs);
+
+#if !USE_IO_URING
+    for(unsigned i = 0; i < gconfig.num_dns_addrs; i++)
+        if(gconfig.dns_addrs[i].udp_io_uring)
+            log_fatal("Config option udp_io_uring: this gdnsd was built without --enable-io-uring");
+#endif
 
     // Assign globally unique thread numbers for each socket-handling thread
     assign_thread_nums();
@@ -729,14 +912,28 @@ void conf_load(const char* cfg_file) {
 
 bool dns_lsock_init(void) {
     bool need_caps = false;
-    const unsigned num_addrs = gconfig.num_dns_addrs;
-    for(unsigned i = 0; i < num_addrs; i++) {
-        dns_addr_t* addrconf = &gconfig.dns_addrs[i];
-        if(udp_sock_setup(addrconf))
-            need_caps = true;
-        if(!addrconf->tcp_disabled)
-            if(tcp_dns_listen_setup(addrconf))
+    const unsigned num_socks = gconfig.num_dns_threads;
+
+    // Claim any sockets received from a previous instance via
+    //  restart_handoff first, and close the rest, so that they can't
+    //  conflict with binding any new ones below
+    for(unsigned i = 0; i < num_socks; i++) {
+        dns_thread_t* t = &gconfig.dns_threads[i];
+        const bool need_reuseport = t->is_udp ? (t->ac->udp_threads > 1) : (t->ac->tcp_threads > 1);
+        t->sock = handoff_take_sock(&t->ac->addr, t->is_udp, need_reuseport);
+    }
+    handoff_close_unclaimed();
+
+    for(unsigned i = 0; i < num_socks; i++) {
+        dns_thread_t* t = &gconfig.dns_threads[i];
+        if(t->is_udp) {
+            if(udp_sock_setup(t))
                 need_caps = true;
+        }
+        else {
+            if(tcp_dns_listen_setup(t))
+                need_caps = true;
+        }
     }
 
     return need_caps;
@@ -24,26 +24,51 @@
 #include "gdnsd.h"
 #include "zscan.h"
 
+// How to steer UDP requests between the SO_REUSEPORT sockets of one address
+typedef enum {
+    UDP_STEER_NONE = 0, // kernel default (4-tuple hash)
+    UDP_STEER_CLIENT,   // hash of the client's subnet
+    UDP_STEER_CPU,      // CPU which received the packet
+} udp_steer_t;
+
 typedef struct {
     anysin_t addr;
-    int      udp_sock;
-    int      tcp_sock;
     bool     tcp_disabled;
-    bool     udp_need_late_bind;
-    bool     tcp_need_late_bind;
+    bool     udp_io_uring;
     unsigned late_bind_secs;
     unsigned tcp_timeout;
     unsigned tcp_clients_per_socket;
-    unsigned tcp_threadnum;
-    unsigned udp_threadnum;
+    unsigned tcp_threads;
+    unsigned tcp_fastopen_qlen;
     unsigned udp_recv_width;
+    unsigned udp_recv_width_min;
     unsigned udp_sndbuf;
     unsigned udp_rcvbuf;
+    unsigned udp_threads;
+    unsigned udp_busy_poll_usecs;
+    unsigned num_thread_cpus;
+    const unsigned* thread_cpus;
+    udp_steer_t udp_reuseport_steer;
 } dns_addr_t;
 
+// One of these per listening socket.  Normally each socket is
+//  owned by exactly one I/O thread, and multiple threads can share
+//  one dns_addr_t (udp_threads or tcp_threads > 1, via SO_REUSEPORT).
+//  With udp_pool_threads, UDP sockets share a smaller set of
+//  threads instead, and threadnum is the owning pool worker.
+typedef struct {
+    dns_addr_t* ac;
+    int      sock; // if >= 0 when *_setup() is called, it came from restart_handoff
+    unsigned threadnum;
+    int      cpu; // CPU the owning thread is pinned to, or -1
+    bool     is_udp;
+    bool     need_late_bind;
+} dns_thread_t;
+
 typedef struct {
     zoneinfo_t* zones;
     dns_addr_t* dns_addrs;
+    dns_thread_t* dns_threads;
     anysin_t*   http_addrs;
     const char*     pidfile;
     const char*     username;
@@ -55,6 +80,9 @@ typedef struct {
     bool     strict_data;
     bool     edns_client_subnet;
     bool     monitor_force_v6_up;
+    bool     udp_latency_stats;
+    bool     restart_handoff;
+    bool     preencode_answers;
     int      priority;
     unsigned zones_default_ttl;
     unsigned log_stats;
@@ -63,10 +91,22 @@ typedef struct {
     unsigned num_zones;
     unsigned num_dns_addrs;
     unsigned num_http_addrs;
+    unsigned num_dns_threads;
     unsigned num_io_threads;
+    unsigned udp_pool_threads;
+    unsigned num_thread_cpus;
+    unsigned* thread_cpus;
     unsigned max_response;
     unsigned max_cname_depth;
     unsigned max_addtl_rrsets;
+    unsigned rrl_responses_per_sec;
+    unsigned rrl_slip;
+    unsigned rrl_ipv4_prefix_len;
+    unsigned rrl_ipv6_prefix_len;
+    unsigned rrl_table_size;
+    unsigned response_cache_size;
+    unsigned dynamic_cache_size;
+    unsigned dynamic_cache_secs;
 } global_config_t;
 
 extern global_config_t gconfig;
@@ -33,112 +33,357 @@
 #include "dnspacket.h"
 #include "pkterr.h"
 
-typedef enum {
-    READING_INITIAL = 0,
-    READING_MORE,
-    WRITING,
-} tcpdns_state_t;
+// Input buffer: room for the largest legal query plus its length
+//  prefix, twice over, so that pipelined queries can be batched.
+#define TCP_RBUF_SIZE (2 * (DNS_RECV_SIZE + 2))
+
+// Output buffer slack beyond a single maximal response, used to queue
+//  up the responses to several pipelined queries for a single send().
+//  When it fills, the queued responses are sent before answering more.
+#define TCP_WBUF_SLACK 4096U
+
+// Connection objects are carved from per-thread chunks of this many,
+//  allocated as the number of simultaneous connections first needs
+//  them, each aligned to this boundary so that neighbors never share
+//  a cache line.
+#define TCP_CONN_CHUNK 16U
+#define TCP_CONN_ALIGN 64U
+
+// Idle timeouts are enforced lazily by a single per-thread timer,
+//  which waits this much longer than strictly necessary so that
+//  connections expiring close together are reaped in one pass.
+#define TCP_TIMEOUT_SLACK 0.25
+
+// The idle timeout never shrinks below this under load (in units
+//  of 100ms, as with edns-tcp-keepalive), and a connection must have
+//  been idle at least this long to be evicted for a new one.
+#define TCP_TIMEOUT_MIN 10U
+
+typedef struct tcpdns_conn_s tcpdns_conn_t;
 
 // per-thread state
 typedef struct {
     dnspacket_context_t* pctx;
     unsigned timeout;
     unsigned max_clients;
-    ev_io* accept_watcher;
-    unsigned int num_conn_watchers;
+    unsigned num_conns;
+    bool fastopen;
+    unsigned wbuf_size;
+    ev_timer* timeout_watcher;
+    size_t conn_stride;         // bytes per connection object in a chunk
+    uint8_t* conn_chunk;        // the most recently allocated chunk
+    unsigned conn_chunk_left;   // objects of conn_chunk not yet handed out
+    unsigned conn_allocated;    // objects in all chunks so far
+    tcpdns_conn_t* free_conns;  // closed connections' objects, for reuse
+    tcpdns_conn_t* lru_head;    // least-recently-active open connection
+    tcpdns_conn_t* lru_tail;    // most-recently-active open connection
 } tcpdns_thread_t;
 
 // per-connection state
-typedef struct {
+struct tcpdns_conn_s {
+    ev_io read_watcher;
+    ev_io write_watcher;
     tcpdns_thread_t* thread_ctx;
-    anysin_t* asin;
-    uint8_t* buffer;
-    ev_io* read_watcher;
-    ev_io* write_watcher;
-    ev_timer* timeout_watcher;
-    unsigned size;
-    unsigned size_done;
-    tcpdns_state_t state;
-} tcpdns_conn_t;
+    tcpdns_conn_t* next_free;
+    tcpdns_conn_t* lru_prev;
+    tcpdns_conn_t* lru_next;
+    ev_tstamp last_active;
+    anysin_t asin;
+    unsigned rbuf_len;  // bytes of unprocessed input in rbuf
+    unsigned wbuf_len;  // bytes of queued responses in wbuf
+    unsigned wbuf_done; // bytes of wbuf already sent
+    bool rd_eof;        // no further input will be read: the client has
+                        //  closed its sending side, or sent a query we drop
+    uint8_t rbuf[TCP_RBUF_SIZE];
+    uint8_t wbuf[];     // thread_ctx->wbuf_size bytes
+};
+
+// Open connections are kept on a doubly-linked list in order of
+//  their last I/O activity, so the next connection to time out
+//  is always at the head, and noting activity is O(1).
+F_NONNULL
+static void conn_lru_unlink(tcpdns_conn_t* tdata) {
+    dmn_assert(tdata);
+
+    tcpdns_thread_t* thread_ctx = tdata->thread_ctx;
+    if(tdata->lru_prev)
+        tdata->lru_prev->lru_next = tdata->lru_next;
+    else
+        thread_ctx->lru_head = tdata->lru_next;
+    if(tdata->lru_next)
+        tdata->lru_next->lru_prev = tdata->lru_prev;
+    else
+        thread_ctx->lru_tail = tdata->lru_prev;
+}
+
+F_NONNULL
+static void conn_lru_append(struct ev_loop* loop, tcpdns_conn_t* tdata) {
+    dmn_assert(loop); dmn_assert(tdata);
+
+    tcpdns_thread_t* thread_ctx = tdata->thread_ctx;
+    tdata->last_active = ev_now(loop);
+    tdata->lru_next = NULL;
+    tdata->lru_prev = thread_ctx->lru_tail;
+    if(thread_ctx->lru_tail)
+        thread_ctx->lru_tail->lru_next = tdata;
+    else
+        thread_ctx->lru_head = tdata;
+    thread_ctx->lru_tail = tdata;
+}
+
+// Resets the idle timeout for a connection which made progress,
+//  meaning that a complete query was read or all queued responses
+//  were sent.  Partial reads and writes don't count, so that a client
+//  trickling bytes can't hold a connection open indefinitely.
+F_NONNULL
+static void conn_lru_touch(struct ev_loop* loop, tcpdns_conn_t* tdata) {
+    dmn_assert(loop); dmn_assert(tdata);
+
+    if(tdata->thread_ctx->lru_tail != tdata) {
+        conn_lru_unlink(tdata);
+        conn_lru_append(loop, tdata);
+    }
+    else {
+        tdata->last_active = ev_now(loop);
+    }
+}
 
 F_NONNULL
 static void cleanup_conn_watchers(struct ev_loop* loop, tcpdns_conn_t* tdata) {
     dmn_assert(loop); dmn_assert(tdata);
 
-    shutdown(tdata->read_watcher->fd, SHUT_RDWR);
-    close(tdata->read_watcher->fd);
-    ev_timer_stop(loop, tdata->timeout_watcher);
-    ev_io_stop(loop, tdata->read_watcher);
-    if(tdata->write_watcher) ev_io_stop(loop, tdata->write_watcher);
-    free(tdata->buffer);
-    free(tdata->timeout_watcher);
-    free(tdata->read_watcher);
-    if(tdata->write_watcher) free(tdata->write_watcher);
-    free(tdata->asin);
-
-    if((tdata->thread_ctx->num_conn_watchers-- == tdata->thread_ctx->max_clients))
-        ev_io_start(loop, tdata->thread_ctx->accept_watcher);
-
-    free(tdata);
+    shutdown(tdata->read_watcher.fd, SHUT_RDWR);
+    close(tdata->read_watcher.fd);
+    ev_io_stop(loop, &tdata->read_watcher);
+    ev_io_stop(loop, &tdata->write_watcher);
+    conn_lru_unlink(tdata);
+
+    tcpdns_thread_t* thread_ctx = tdata->thread_ctx;
+    tdata->next_free = thread_ctx->free_conns;
+    thread_ctx->free_conns = tdata;
+    thread_ctx->num_conns--;
+}
+
+// The idle timeout currently in effect, in units of 100ms.  This is
+//  the full tcp_timeout while at most half of max_clients are in use,
+//  and beyond that shrinks linearly as free connection slots run out,
+//  so that load is shed gracefully.  The same value is advertised to
+//  clients via edns-tcp-keepalive (RFC 7828), so that they close idle
+//  connections themselves before we'd have to.
+F_NONNULL F_PURE
+static unsigned tcp_idle_timeout(const tcpdns_thread_t* thread_ctx) {
+    dmn_assert(thread_ctx);
+    dmn_assert(thread_ctx->num_conns <= thread_ctx->max_clients);
+
+    const unsigned full = thread_ctx->timeout * 10;
+    const unsigned num_free = thread_ctx->max_clients - thread_ctx->num_conns;
+    unsigned rv = full * 2 * num_free / thread_ctx->max_clients;
+    if(rv > full)
+        rv = full;
+    else if(rv < TCP_TIMEOUT_MIN)
+        rv = TCP_TIMEOUT_MIN;
+    return rv;
+}
+
+// Arms the thread's timeout watcher for the connection at the head
+//  of the LRU list, or stops it if there are no open connections.
+F_NONNULL
+static void tcp_timeout_rearm(struct ev_loop* loop, tcpdns_thread_t* thread_ctx) {
+    dmn_assert(loop); dmn_assert(thread_ctx);
+
+    ev_timer* t = thread_ctx->timeout_watcher;
+    if(thread_ctx->lru_head) {
+        const ev_tstamp expire = thread_ctx->lru_head->last_active + tcp_idle_timeout(thread_ctx) * 0.1;
+        const ev_tstamp wait = expire - ev_now(loop);
+        t->repeat = (wait > 0 ? wait : 0) + TCP_TIMEOUT_SLACK;
+        ev_timer_again(loop, t);
+    }
+    else {
+        ev_timer_stop(loop, t);
+    }
 }
 
 F_NONNULL
-static void tcp_timeout_handler(struct ev_loop* loop V_UNUSED, ev_timer* t, const int revents V_UNUSED) {
+static void tcp_timeout_handler(struct ev_loop* loop, ev_timer* t, const int revents V_UNUSED) {
     dmn_assert(loop); dmn_assert(t);
     dmn_assert(revents == EV_TIMER);
 
-    tcpdns_conn_t* tdata = (tcpdns_conn_t*)t->data;
-    log_pkterr("TCP DNS Connection timed out while %s %s",
-        tdata->state == WRITING ? "writing to" : "reading from", logf_anysin(tdata->asin));
+    tcpdns_thread_t* thread_ctx = (tcpdns_thread_t*)t->data;
+    const ev_tstamp now = ev_now(loop);
 
-    if(tdata->state == WRITING)
-        satom_inc(&tdata->thread_ctx->pctx->stats->p.tcp.sendfail);
-    else
-        satom_inc(&tdata->thread_ctx->pctx->stats->p.tcp.recvfail);
+    tcpdns_conn_t* tdata;
+    while((tdata = thread_ctx->lru_head)
+      && tdata->last_active <= now - tcp_idle_timeout(thread_ctx) * 0.1) {
+        const bool writing = tdata->wbuf_len ? true : false;
+        log_pkterr("TCP DNS Connection timed out while %s %s",
+            writing ? "writing to" : "reading from", logf_anysin(&tdata->asin));
+
+        if(writing)
+            satom_inc(&thread_ctx->pctx->stats->p.tcp.sendfail);
+        else
+            satom_inc(&thread_ctx->pctx->stats->p.tcp.recvfail);
+
+        cleanup_conn_watchers(loop, tdata);
+    }
 
-    cleanup_conn_watchers(loop, tdata);
+    tcp_timeout_rearm(loop, thread_ctx);
 }
 
+// Sends as much of the queued output as the socket will accept.
+// retval: false if the connection was closed due to an error
 F_NONNULL
-static void tcp_write_handler(struct ev_loop* loop, ev_io* io, const int revents V_UNUSED) {
-    dmn_assert(loop); dmn_assert(io);
-    dmn_assert(revents == EV_WRITE);
+static bool tcp_flush(struct ev_loop* loop, tcpdns_conn_t* tdata) {
+    dmn_assert(loop); dmn_assert(tdata);
+    dmn_assert(tdata->wbuf_len > tdata->wbuf_done);
 
-    tcpdns_conn_t* tdata = (tcpdns_conn_t*)io->data;
-    const size_t wanted = tdata->size - tdata->size_done;
-    const uint8_t* source = tdata->buffer + tdata->size_done;
+    const size_t wanted = tdata->wbuf_len - tdata->wbuf_done;
+    const uint8_t* source = &tdata->wbuf[tdata->wbuf_done];
 
-    const ssize_t written = send(io->fd, source, wanted, 0);
+    const ssize_t written = send(tdata->write_watcher.fd, source, wanted, 0);
     if(unlikely(written == -1)) {
         if(errno != EAGAIN) {
-            log_pkterr("TCP DNS send() failed, dropping response to %s: %s", logf_anysin(tdata->asin), logf_errno());
+            log_pkterr("TCP DNS send() failed, dropping response to %s: %s", logf_anysin(&tdata->asin), logf_errno());
             satom_inc(&tdata->thread_ctx->pctx->stats->p.tcp.sendfail);
             cleanup_conn_watchers(loop, tdata);
-            return;
+            return false;
         }
     }
-    else { // we sent something...
-        tdata->size_done += written;
-        if(likely(tdata->size_done == tdata->size)) {
-            ev_timer_again(loop, tdata->timeout_watcher);
-            tdata->state = READING_INITIAL;
-            if(tdata->write_watcher) ev_io_stop(loop, tdata->write_watcher);
-            ev_io_start(loop, tdata->read_watcher);
-            tdata->size_done = 0;
-            tdata->size = 0;
-            return;
+    else {
+        tdata->wbuf_done += written;
+        if(likely(tdata->wbuf_done == tdata->wbuf_len)) {
+            tdata->wbuf_done = 0;
+            tdata->wbuf_len = 0;
+            conn_lru_touch(loop, tdata);
+        }
+    }
+
+    return true;
+}
+
+// Answers every complete query in rbuf (in order), queueing the
+//  responses in wbuf, until we run out of complete queries or the
+//  socket won't accept the queued responses to make room for more.
+//  Consumed input is removed from the front of rbuf.  A query which
+//  gets no response stops all further input, and the connection is
+//  closed once the responses queued ahead of it have been sent.
+// retval: false if the connection was closed due to an error
+F_NONNULL
+static bool tcp_process_input(struct ev_loop* loop, tcpdns_conn_t* tdata) {
+    dmn_assert(loop); dmn_assert(tdata);
+
+    tcpdns_thread_t* thread_ctx = tdata->thread_ctx;
+    const unsigned resp_max = gconfig.max_response + 2;
+    thread_ctx->pctx->edns_tcp_keepalive = tcp_idle_timeout(thread_ctx);
+    unsigned rpos = 0;
+
+    while(tdata->rbuf_len - rpos > 1) {
+        const uint8_t* query = &tdata->rbuf[rpos];
+        const unsigned qlen = (query[0] << 8) + query[1];
+
+        // Incomplete queries are moved to the front of rbuf to wait
+        //  for the rest, so this is the most that can ever arrive
+        if(unlikely(qlen + 2 > TCP_RBUF_SIZE)) {
+            log_pkterr("Oversized TCP DNS query of length %u from %s", qlen + 2, logf_anysin(&tdata->asin));
+            satom_inc(&thread_ctx->pctx->stats->p.tcp.recvsize);
+            cleanup_conn_watchers(loop, tdata);
+            return false;
+        }
+
+        if(tdata->rbuf_len - rpos < qlen + 2)
+            break; // incomplete query, need more input
+
+        // Out of room to queue another response: send what's queued
+        //  so far, and carry on if the socket took all of it
+        if(thread_ctx->wbuf_size - tdata->wbuf_len < resp_max) {
+            if(!tcp_flush(loop, tdata))
+                return false;
+            if(tdata->wbuf_len)
+                break;
+        }
+
+        // The query is copied to the tail of wbuf and the
+        //  response is built in-place over it.
+        dmn_assert(qlen <= gconfig.max_response);
+        uint8_t* resp = &tdata->wbuf[tdata->wbuf_len];
+        memcpy(&resp[2], &query[2], qlen);
+        rpos += qlen + 2;
+
+        const unsigned rlen = process_dns_query(thread_ctx->pctx, &tdata->asin, &resp[2], qlen);
+        if(!rlen) {
+            // Read and answer nothing further, but let tcp_conn_run()
+            //  send the earlier responses before closing
+            tdata->rd_eof = true;
+            rpos = tdata->rbuf_len;
+            break;
         }
+        *(uint16_t*)resp = htons(rlen);
+        tdata->wbuf_len += rlen + 2;
     }
 
-    // Setup/Start write watcher if necc
-    if(!tdata->write_watcher) {
-        ev_io* write_watcher = malloc(sizeof(ev_io));
-        tdata->write_watcher = write_watcher;
-        write_watcher->data = tdata;
-        ev_io_init(write_watcher, tcp_write_handler, io->fd, EV_WRITE);
-        ev_set_priority(write_watcher, 1);
+    if(rpos) {
+        tdata->rbuf_len -= rpos;
+        memmove(tdata->rbuf, &tdata->rbuf[rpos], tdata->rbuf_len);
+        conn_lru_touch(loop, tdata);
     }
-    ev_io_start(loop, tdata->write_watcher);
+
+    return true;
+}
+
+// Drives the connection after any new input or output progress:
+//  answers queued queries, flushes responses, and then leaves
+//  the read and write watchers in the right states for whatever
+//  is still pending.
+F_NONNULL
+static void tcp_conn_run(struct ev_loop* loop, tcpdns_conn_t* tdata) {
+    dmn_assert(loop); dmn_assert(tdata);
+
+    // Most likely the responses fit in the socket buffers
+    //  as well as the window size, and therefore a complete
+    //  write can proceed immediately, so try it without
+    //  going through the loop.  A completed write may make
+    //  room to answer further queries already buffered.
+    while(1) {
+        if(!tcp_process_input(loop, tdata))
+            return;
+        if(!tdata->wbuf_len)
+            break;
+        if(!tcp_flush(loop, tdata))
+            return;
+        if(tdata->wbuf_len)
+            break;
+    }
+
+    if(tdata->rd_eof && !tdata->wbuf_len) {
+        if(tdata->rbuf_len) {
+            log_pkterr("TCP DNS recv() from %s: Unexpected EOF", logf_anysin(&tdata->asin));
+            satom_inc(&tdata->thread_ctx->pctx->stats->p.tcp.recvfail);
+        }
+        cleanup_conn_watchers(loop, tdata);
+        return;
+    }
+
+    if(tdata->wbuf_len)
+        ev_io_start(loop, &tdata->write_watcher);
+    else
+        ev_io_stop(loop, &tdata->write_watcher);
+
+    if(!tdata->rd_eof && tdata->rbuf_len < TCP_RBUF_SIZE)
+        ev_io_start(loop, &tdata->read_watcher);
+    else
+        ev_io_stop(loop, &tdata->read_watcher);
+}
+
+F_NONNULL
+static void tcp_write_handler(struct ev_loop* loop, ev_io* io, const int revents V_UNUSED) {
+    dmn_assert(loop); dmn_assert(io);
+    dmn_assert(revents == EV_WRITE);
+
+    tcpdns_conn_t* tdata = (tcpdns_conn_t*)io->data;
+    dmn_assert(tdata);
+
+    // tcp_conn_run() does the flush, after queueing any further
+    //  responses there is room for
+    tcp_conn_run(loop, tdata);
 }
 
 F_NONNULL
@@ -148,77 +393,68 @@ static void tcp_read_handler(struct ev_loop* loop, ev_io* io, const int revents
     tcpdns_conn_t* tdata = (tcpdns_conn_t*)io->data;
 
     dmn_assert(tdata);
-    dmn_assert(tdata->state == READING_INITIAL || tdata->state == READING_MORE);
+    dmn_assert(!tdata->rd_eof);
+    dmn_assert(tdata->rbuf_len < TCP_RBUF_SIZE);
 
-    uint8_t* destination = &tdata->buffer[tdata->size_done];
-    const size_t wanted =
-        (tdata->state == READING_INITIAL ? DNS_RECV_SIZE : tdata->size)
-        - tdata->size_done;
+    uint8_t* destination = &tdata->rbuf[tdata->rbuf_len];
+    const size_t wanted = TCP_RBUF_SIZE - tdata->rbuf_len;
 
     const ssize_t pktlen = recv(io->fd, destination, wanted, 0);
     if(pktlen < 1) {
-        if(unlikely(pktlen == -1 || tdata->size_done)) {
-            if(pktlen == -1) {
-                if(errno == EAGAIN) {
-#                   ifdef TCP_DEFER_ACCEPT
-                        ev_io_start(loop, tdata->read_watcher);
-#                   endif
-                    return;
-                }
-                log_pkterr("TCP DNS recv() from %s: %s", logf_anysin(tdata->asin), logf_errno());
-            }
-            else if(tdata->size_done) {
-                log_pkterr("TCP DNS recv() from %s: Unexpected EOF", logf_anysin(tdata->asin));
+        if(pktlen == -1) {
+            if(errno == EAGAIN) {
+                // From a direct call in accept_handler()
+                ev_io_start(loop, &tdata->read_watcher);
+                return;
             }
+            log_pkterr("TCP DNS recv() from %s: %s", logf_anysin(&tdata->asin), logf_errno());
             satom_inc(&tdata->thread_ctx->pctx->stats->p.tcp.recvfail);
+            cleanup_conn_watchers(loop, tdata);
+            return;
         }
-        cleanup_conn_watchers(loop, tdata);
-        return;
+        // EOF: answer whatever complete queries we have, then close
+        tdata->rd_eof = true;
     }
-
-    tdata->size_done += pktlen;
-
-    if(likely(tdata->state == READING_INITIAL)) {
-        if(likely(tdata->size_done > 1)) {
-            tdata->size = (tdata->buffer[0] << 8) + tdata->buffer[1] + 2;
-            if(unlikely(tdata->size > DNS_RECV_SIZE)) {
-                log_pkterr("Oversized TCP DNS query of length %u from %s", tdata->size, logf_anysin(tdata->asin));
-                satom_inc(&tdata->thread_ctx->pctx->stats->p.tcp.recvsize);
-                cleanup_conn_watchers(loop, tdata);
-                return;
-            }
-            tdata->state = READING_MORE;
-        }
+    else {
+        tdata->rbuf_len += pktlen;
     }
 
-    if(unlikely(tdata->size_done < tdata->size)) {
-#       ifdef TCP_DEFER_ACCEPT
-            ev_io_start(loop, tdata->read_watcher);
-#       endif
-        return;
-    }
+    tcp_conn_run(loop, tdata);
+}
 
-    //  Process the query and start the writer
-    tdata->size = process_dns_query(tdata->thread_ctx->pctx, tdata->asin, &tdata->buffer[2], tdata->size - 2);
-    if(!tdata->size) {
-        cleanup_conn_watchers(loop, tdata);
-        return;
+// Reuses a closed connection's object if there is one, and otherwise
+//  takes the next never-used object from the current chunk, allocating
+//  a new chunk when that runs out.  Chunks are never freed, so memory
+//  use follows the peak number of simultaneous connections, and is
+//  only allocated a chunk at a time on the way there.
+F_NONNULL F_WUNUSED
+static tcpdns_conn_t* conn_get(tcpdns_thread_t* thread_ctx) {
+    dmn_assert(thread_ctx);
+
+    tcpdns_conn_t* tdata = thread_ctx->free_conns;
+    if(tdata) {
+        thread_ctx->free_conns = tdata->next_free;
+        return tdata;
     }
 
-    ev_io_stop(loop, tdata->read_watcher);
-    *(uint16_t*)tdata->buffer = htons(tdata->size);
-    tdata->size += 2;
-    tdata->size_done = 0;
-    tdata->state = WRITING;
+    if(!thread_ctx->conn_chunk_left) {
+        dmn_assert(thread_ctx->conn_allocated < thread_ctx->max_clients);
+        unsigned count = thread_ctx->max_clients - thread_ctx->conn_allocated;
+        if(count > TCP_CONN_CHUNK)
+            count = TCP_CONN_CHUNK;
+        void* chunk;
+        if(posix_memalign(&chunk, TCP_CONN_ALIGN, thread_ctx->conn_stride * count))
+            log_fatal("Failed to allocate %u TCP DNS connection objects", count);
+        thread_ctx->conn_chunk = chunk;
+        thread_ctx->conn_chunk_left = count;
+        thread_ctx->conn_allocated += count;
+    }
 
-    // Most likely the response fits in the socket buffers
-    //  as well as the window size, and therefore a complete
-    //  write can proceed immediately, so try it without
-    //  going through the loop.  tcp_write_handler() will
-    //  start its own watcher if necc.  We can use the
-    //  read_watcher (aka io here) as the ev_io for this invocation,
-    //  since all the code cares about is ->data and ->fd.
-    tcp_write_handler(loop, io, EV_WRITE);
+    tdata = (tcpdns_conn_t*)thread_ctx->conn_chunk;
+    thread_ctx->conn_chunk += thread_ctx->conn_stride;
+    thread_ctx->conn_chunk_left--;
+    tdata->thread_ctx = thread_ctx;
+    return tdata;
 }
 
 F_NONNULL
@@ -228,17 +464,16 @@ static void accept_handler(struct ev_loop* loop, ev_io* io, const int revents V_
 
     tcpdns_thread_t* thread_ctx = (tcpdns_thread_t*)io->data;
 
-    anysin_t* asin = malloc(sizeof(anysin_t));
-    asin->len = ANYSIN_MAXLEN;
+    anysin_t asin;
+    asin.len = ANYSIN_MAXLEN;
 
 #ifdef USE_ACCEPT4
-    const int sock = accept4(io->fd, &asin->sa, &asin->len, SOCK_NONBLOCK);
+    const int sock = accept4(io->fd, &asin.sa, &asin.len, SOCK_NONBLOCK);
 #else
-    const int sock = accept(io->fd, &asin->sa, &asin->len);
+    const int sock = accept(io->fd, &asin.sa, &asin.len);
 #endif
 
     if(unlikely(sock == -1)) {
-        free(asin);
         switch(errno) {
             case EAGAIN:
             case EINTR:
@@ -259,46 +494,72 @@ static void accept_handler(struct ev_loop* loop, ev_io* io, const int revents V_
         return;
     }
 
-    log_debug("Received TCP DNS connection from %s", logf_anysin(asin));
+    log_debug("Received TCP DNS connection from %s", logf_anysin(&asin));
 
 #ifndef USE_ACCEPT4
     if(unlikely(fcntl(sock, F_SETFL, (fcntl(sock, F_GETFL, 0)) | O_NONBLOCK) == -1)) {
-        free(asin);
         close(sock);
         log_err("Failed to set O_NONBLOCK on inbound TCP DNS socket: %s", logf_errno());
         return;
     }
 #endif
 
-    if((++thread_ctx->num_conn_watchers == thread_ctx->max_clients))
-        ev_io_stop(loop, thread_ctx->accept_watcher);
+    // At capacity, make room by closing the connection which has
+    //  been idle the longest, so that piles of idle clients can't lock
+    //  new ones out until they time out.  Only connections with no
+    //  partial query or unsent responses which have been idle for
+    //  TCP_TIMEOUT_MIN qualify; if there are none, the new connection
+    //  is refused instead.
+    if(unlikely(thread_ctx->num_conns == thread_ctx->max_clients)) {
+        const ev_tstamp idle_since = ev_now(loop) - TCP_TIMEOUT_MIN * 0.1;
+        tcpdns_conn_t* victim = thread_ctx->lru_head;
+        while(victim && victim->last_active <= idle_since
+          && (victim->rbuf_len || victim->wbuf_len))
+            victim = victim->lru_next;
+        if(!victim || victim->last_active > idle_since) {
+            log_debug("TCP DNS connection limit reached, refusing connection from %s", logf_anysin(&asin));
+            close(sock);
+            return;
+        }
+        log_debug("TCP DNS connection limit reached, closing idle connection from %s", logf_anysin(&victim->asin));
+        satom_inc(&thread_ctx->pctx->stats->p.tcp.evicted);
+        cleanup_conn_watchers(loop, victim);
+    }
 
-    tcpdns_conn_t* tdata = calloc(1, sizeof(tcpdns_conn_t));
-    tdata->buffer = malloc(gconfig.max_response + 2);
-    tdata->thread_ctx = thread_ctx;
-    tdata->state = READING_INITIAL;
-    tdata->asin = asin;
+    tcpdns_conn_t* tdata = conn_get(thread_ctx);
+    thread_ctx->num_conns++;
 
-    ev_io* read_watcher = malloc(sizeof(ev_io));
-    tdata->read_watcher = read_watcher;
-    read_watcher->data = tdata;
+    memcpy(&tdata->asin, &asin, sizeof(anysin_t));
+    tdata->rbuf_len = 0;
+    tdata->wbuf_len = 0;
+    tdata->wbuf_done = 0;
+    tdata->rd_eof = false;
+
+    ev_io* read_watcher = &tdata->read_watcher;
     ev_io_init(read_watcher, tcp_read_handler, sock, EV_READ);
+    read_watcher->data = tdata;
     ev_set_priority(read_watcher, 0);
 
-    ev_timer* timeout_watcher = malloc(sizeof(ev_timer));
-    timeout_watcher->data = tdata;
-    tdata->timeout_watcher = timeout_watcher;
-    ev_timer_init(timeout_watcher, tcp_timeout_handler, 0, thread_ctx->timeout);
-    ev_set_priority(timeout_watcher, -1);
-    ev_timer_again(loop, timeout_watcher);
+    ev_io* write_watcher = &tdata->write_watcher;
+    ev_io_init(write_watcher, tcp_write_handler, sock, EV_WRITE);
+    write_watcher->data = tdata;
+    ev_set_priority(write_watcher, 1);
 
+    // Rearm even if it's already running, as the new connection may
+    //  have shortened the idle timeout for everyone
+    conn_lru_append(loop, tdata);
+    tcp_timeout_rearm(loop, thread_ctx);
+
+    // With DEFER_ACCEPT or Fast Open, the request is likely already
+    //  queued and available at this point (for TFO, it arrived with
+    //  the SYN), so start read()-ing without going through the loop
 #ifdef TCP_DEFER_ACCEPT
-    // Since we use DEFER_ACCEPT, the request is likely already
-    //  queued and available at this point, so start read()-ing
-    //  without going through the event loop
-    tcp_read_handler(loop, tdata->read_watcher, EV_READ);
+    tcp_read_handler(loop, read_watcher, EV_READ);
 #else
-    ev_io_start(loop, read_watcher);
+    if(thread_ctx->fastopen)
+        tcp_read_handler(loop, read_watcher, EV_READ);
+    else
+        ev_io_start(loop, read_watcher);
 #endif
 }
 
@@ -314,6 +575,17 @@ static void accept_handler(struct ev_loop* loop, ev_io* io, const int revents V_
 #define SOL_TCP IPPROTO_TCP
 #endif
 
+// The listening socket options which depend on the current config,
+//  separate from tcp_listen_pre_setup() so that they're also applied
+//  to sockets inherited via restart_handoff.
+static void tcp_listen_config_setup(const int sock V_UNUSED, const int timeout V_UNUSED) {
+#ifdef TCP_DEFER_ACCEPT
+    const int opt_timeout = timeout;
+    if(setsockopt(sock, SOL_TCP, TCP_DEFER_ACCEPT, &opt_timeout, sizeof opt_timeout) == - 1)
+        log_fatal("Failed to set TCP_DEFER_ACCEPT on TCP socket: %s", logf_errno());
+#endif
+}
+
 int tcp_listen_pre_setup(const anysin_t* asin, const int timeout V_UNUSED) {
 
     dmn_assert(asin);
@@ -331,11 +603,7 @@ int tcp_listen_pre_setup(const anysin_t* asin, const int timeout V_UNUSED) {
     if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt_one, sizeof opt_one) == -1)
         log_fatal("Failed to set SO_REUSEADDR on TCP socket: %s", logf_errno());
 
-#ifdef TCP_DEFER_ACCEPT
-    const int opt_timeout = timeout;
-    if(setsockopt(sock, SOL_TCP, TCP_DEFER_ACCEPT, &opt_timeout, sizeof opt_timeout) == - 1)
-        log_fatal("Failed to set TCP_DEFER_ACCEPT on TCP socket: %s", logf_errno());
-#endif
+    tcp_listen_config_setup(sock, timeout);
 
     if(isv6)
         if(setsockopt(sock, SOL_IPV6, IPV6_V6ONLY, &opt_one, sizeof(opt_one)) == -1)
@@ -344,15 +612,57 @@ int tcp_listen_pre_setup(const anysin_t* asin, const int timeout V_UNUSED) {
     return sock;
 }
 
-bool tcp_dns_listen_setup(dns_addr_t *addrconf) {
+bool tcp_dns_listen_setup(dns_thread_t* t) {
+    dmn_assert(t);
+
+    const dns_addr_t* addrconf = t->ac;
     dmn_assert(addrconf);
 
     const anysin_t* asin = &addrconf->addr;
 
-    addrconf->tcp_sock = tcp_listen_pre_setup(&addrconf->addr, addrconf->tcp_timeout);
-    if(bind(addrconf->tcp_sock, &asin->sa, asin->len)) {
+    // A socket received via restart_handoff is already bound and
+    //  listening, but still gets the options below (and
+    //  TCP_DEFER_ACCEPT) for the current config, except for those which
+    //  only matter at bind() time (see udp_sock_setup())
+    const bool inherited = (t->sock >= 0);
+    if(inherited)
+        tcp_listen_config_setup(t->sock, addrconf->tcp_timeout);
+    else
+        t->sock = tcp_listen_pre_setup(&addrconf->addr, addrconf->tcp_timeout);
+
+    if(addrconf->tcp_fastopen_qlen) {
+#ifdef TCP_FASTOPEN
+        const int opt_qlen = addrconf->tcp_fastopen_qlen;
+        if(setsockopt(t->sock, SOL_TCP, TCP_FASTOPEN, &opt_qlen, sizeof opt_qlen) == -1)
+            log_warn("Failed to enable TCP Fast Open on TCP socket %s: %s", logf_anysin(asin), logf_errno());
+#else
+        log_warn("tcp_fastopen_qlen for %s is not supported on this platform (no TCP_FASTOPEN), ignoring", logf_anysin(asin));
+#endif
+    }
+
+    // Multiple threads per address each get their own listening
+    //  socket, and the kernel balances new connections between them
+    if(!inherited && addrconf->tcp_threads > 1) {
+#ifdef SO_REUSEPORT
+        const int opt_one = 1;
+        if(setsockopt(t->sock, SOL_SOCKET, SO_REUSEPORT, &opt_one, sizeof opt_one) == -1)
+            log_fatal("Failed to set SO_REUSEPORT on TCP socket: %s", logf_errno());
+#else
+        log_fatal("tcp_threads > 1 for %s is not supported on this platform (no SO_REUSEPORT)", logf_anysin(asin));
+#endif
+    }
+
+    // With thread_cpus, prefer connections arriving on our thread's CPU
+    if(t->cpu >= 0) {
+#ifdef SO_INCOMING_CPU
+        if(setsockopt(t->sock, SOL_SOCKET, SO_INCOMING_CPU, &t->cpu, sizeof t->cpu) == -1)
+            log_warn("Failed to set SO_INCOMING_CPU on TCP socket %s: %s", logf_anysin(asin), logf_errno());
+#endif
+    }
+
+    if(!inherited && bind(t->sock, &asin->sa, asin->len)) {
         if(addrconf->late_bind_secs && errno == EADDRNOTAVAIL) {
-            addrconf->tcp_need_late_bind = 1;
+            t->need_late_bind = true;
             log_info("TCP DNS socket %s not yet available, will attempt late bind every %u seconds", logf_anysin(asin), addrconf->late_bind_secs);
             const bool isv6 = asin->sa.sa_family == AF_INET6 ? true : false;
             return ntohs(isv6 ? asin->sin6.sin6_port : asin->sin.sin_port) < 1024 ? true : false;
@@ -360,29 +670,51 @@ bool tcp_dns_listen_setup(dns_addr_t *addrconf) {
         log_fatal("Failed to bind() TCP socket to %s: %s", logf_anysin(asin), logf_errno());
     }
 
-    if(listen(addrconf->tcp_sock, addrconf->tcp_clients_per_socket) == -1)
+    if(listen(t->sock, addrconf->tcp_clients_per_socket) == -1)
         log_fatal("Failed to listen(s, %i) on TCP socket %s: %s", addrconf->tcp_clients_per_socket, logf_anysin(asin), logf_errno());
 
     return false;
 }
 
-void* dnsio_tcp_start(void* addrconf_asvoid) {
-    dmn_assert(addrconf_asvoid);
+// Nothing is allocated here: conn_get() allocates connection objects
+//  a chunk at a time as they're first needed, and after that accept()
+//  and close() only move them on and off the free list.
+F_NONNULL
+static void conn_pool_init(tcpdns_thread_t* thread_ctx) {
+    dmn_assert(thread_ctx);
+
+    thread_ctx->conn_stride = (sizeof(tcpdns_conn_t) + thread_ctx->wbuf_size + TCP_CONN_ALIGN - 1)
+        & ~((size_t)TCP_CONN_ALIGN - 1);
+    thread_ctx->conn_chunk = NULL;
+    thread_ctx->conn_chunk_left = 0;
+    thread_ctx->conn_allocated = 0;
+    thread_ctx->free_conns = NULL;
+    thread_ctx->lru_head = NULL;
+    thread_ctx->lru_tail = NULL;
+}
+
+void* dnsio_tcp_start(void* thread_asvoid) {
+    dmn_assert(thread_asvoid);
 
-    const dns_addr_t* addrconf = (const dns_addr_t*)addrconf_asvoid;
+    const dns_thread_t* t = (const dns_thread_t*)thread_asvoid;
+    dmn_assert(!t->is_udp);
+    const dns_addr_t* addrconf = t->ac;
 
     tcpdns_thread_t* thread_ctx = malloc(sizeof(tcpdns_thread_t));
-    thread_ctx->pctx = dnspacket_context_new(addrconf->tcp_threadnum, false);
+    thread_ctx->pctx = dnspacket_context_new(t->threadnum, false);
 
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
-    thread_ctx->num_conn_watchers = 0;
     thread_ctx->timeout = addrconf->tcp_timeout;
     thread_ctx->max_clients = addrconf->tcp_clients_per_socket;
+    thread_ctx->num_conns = 0;
+    thread_ctx->fastopen = addrconf->tcp_fastopen_qlen ? true : false;
+    thread_ctx->wbuf_size = gconfig.max_response + 2 + TCP_WBUF_SLACK;
+    conn_pool_init(thread_ctx);
 
-    if(addrconf->tcp_need_late_bind) {
+    if(t->need_late_bind) {
         const anysin_t* asin = &addrconf->addr;
-        while(bind(addrconf->tcp_sock, &asin->sa, asin->len)) {
+        while(bind(t->sock, &asin->sa, asin->len)) {
             if(errno != EADDRNOTAVAIL) {
                 log_err("Failed late bind() of TCP socket to %s: %s.  This listener thread is now shutting down.  Late bind attempts for this socket will no longer be attempted!", logf_anysin(asin), logf_errno());
                 pthread_exit(NULL);
@@ -390,17 +722,22 @@ void* dnsio_tcp_start(void* addrconf_asvoid) {
             sleep(addrconf->late_bind_secs);
         }
 
-        if(listen(addrconf->tcp_sock, addrconf->tcp_clients_per_socket) == -1)
+        if(listen(t->sock, addrconf->tcp_clients_per_socket) == -1)
             log_fatal("Failed to listen(s, %i) on late-bound TCP socket %s: %s", addrconf->tcp_clients_per_socket, logf_anysin(asin), logf_errno());
 
         log_info("Late bind() of TCP socket to %s succeeded, serving requests now", logf_anysin(asin));
     }
 
-    struct ev_io* accept_watcher = thread_ctx->accept_watcher = malloc(sizeof(struct ev_io));
-    ev_io_init(accept_watcher, accept_handler, addrconf->tcp_sock, EV_READ);
+    struct ev_io* accept_watcher = malloc(sizeof(struct ev_io));
+    ev_io_init(accept_watcher, accept_handler, t->sock, EV_READ);
     ev_set_priority(accept_watcher, -2);
     accept_watcher->data = thread_ctx;
 
+    ev_timer* timeout_watcher = thread_ctx->timeout_watcher = malloc(sizeof(ev_timer));
+    ev_timer_init(timeout_watcher, tcp_timeout_handler, 0, thread_ctx->timeout);
+    ev_set_priority(timeout_watcher, -1);
+    timeout_watcher->data = thread_ctx;
+
     struct ev_loop* loop = ev_loop_new(EVFLAG_AUTO);
     if(!loop) log_fatal("ev_loop_new() failed");
     ev_set_timeout_collect_interval(loop, 0.1);
@@ -411,4 +748,3 @@ void* dnsio_tcp_start(void* addrconf_asvoid) {
 
     return NULL;
 }
-
@@ -31,7 +31,7 @@
 #endif
 
 F_NONNULL
-void* dnsio_tcp_start(void* addrconf_asvoid);
+void* dnsio_tcp_start(void* thread_asvoid);
 
 // Retval is socket. This is common code re-used by the statio listener as well,
 //  the socket is created and set for non-block, TCP_DEFER_ACCEPT if available, IPV6_V6ONLY
@@ -42,6 +42,6 @@ int tcp_listen_pre_setup(const anysin_t* asin, const int timeout V_UNUSED);
 
 // retval indicates network bind caps needed for late binding
 F_NONNULL
-bool tcp_dns_listen_setup(dns_addr_t *addrconf);
+bool tcp_dns_listen_setup(dns_thread_t* t);
 
 #endif // _GDNSD_DNSIO_TCP_H
@@ -31,10 +31,20 @@
 #include <netinet/udp.h>
 #include <pthread.h>
 #include <sys/mman.h>
+#include <time.h>
+
+#if defined HAVE_EPOLL_CTL && defined HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #include "conf.h"
 #include "dnswire.h"
 #include "dnspacket.h"
+#include "dnsio_uring.h"
+
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 
 #ifndef SOL_IPV6
 #define SOL_IPV6 IPPROTO_IPV6
@@ -46,6 +56,58 @@
 
 static bool has_mmsg(void);
 
+// We need to use cmsg stuff in the case of any IPv6 address (at minimum,
+//  to copy the flow label correctly, if not the interface + source addr),
+//  as well as the IPv4 any-address (for correct source address), and
+//  for everything when receiving kernel timestamps for udp_latency_stats.
+F_NONNULL F_PURE
+static bool needs_cmsg(const anysin_t* asin) {
+    dmn_assert(asin);
+    dmn_assert(asin->sa.sa_family == AF_INET6 || asin->sa.sa_family == AF_INET);
+    return (asin->sa.sa_family == AF_INET6 || gdnsd_anysin_is_anyaddr(asin) || gconfig.udp_latency_stats)
+        ? true
+        : false;
+}
+
+uint64_t udp_cmsg_take_rx_ts(struct msghdr* mh) {
+    dmn_assert(mh);
+#ifdef SCM_TIMESTAMPNS
+    for(struct cmsghdr* cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+        if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            // Close the gap left by this message in the control buffer
+            const size_t offset = (size_t)((char*)cm - (char*)mh->msg_control);
+            size_t space = CMSG_ALIGN(cm->cmsg_len);
+            if(space > mh->msg_controllen - offset)
+                space = mh->msg_controllen - offset;
+            memmove(cm, (char*)cm + space, mh->msg_controllen - offset - space);
+            mh->msg_controllen -= space;
+            return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+        }
+    }
+#endif
+    return 0;
+}
+
+uint64_t udp_rx_ts_now(void) {
+    // Kernel receive timestamps are CLOCK_REALTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+void udp_record_latency(dnspacket_stats_t* stats, const uint64_t rx_ts, const uint64_t now) {
+    dmn_assert(stats);
+    if(unlikely(!rx_ts || now < rx_ts))
+        return;
+    const uint64_t usecs = (now - rx_ts) / 1000U;
+    unsigned bucket = 0;
+    while(bucket < (UDP_LAT_BUCKETS - 1) && (usecs >> (bucket + 1)))
+        bucket++;
+    satom_inc(&stats->p.udp.latency[bucket]);
+}
+
 static void udp_sock_opts_v4(const int sock V_UNUSED, const bool any_addr) {
     const int opt_one V_UNUSED = 1;
     // If all variants we know of don't exist, we simply assume the IP
@@ -100,7 +162,7 @@ static void udp_sock_opts_v4(const int sock V_UNUSED, const bool any_addr) {
  *  1280 or disable IPv6 completely for this platform.
  */
 
-static void udp_sock_opts_v6(const int sock) {
+static void udp_sock_opts_v6(const int sock, const bool inherited) {
     const int opt_one = 1;
 
 #if defined IPV6_USE_MIN_MTU
@@ -115,7 +177,8 @@ static void udp_sock_opts_v6(const int sock) {
         log_fatal("Failed to set IPV6_MTU on UDP socket: %s", logf_errno());
 #endif
 
-    if(setsockopt(sock, SOL_IPV6, IPV6_V6ONLY, &opt_one, sizeof opt_one) == -1)
+    // Only settable before bind(), so an inherited socket keeps its own
+    if(!inherited && setsockopt(sock, SOL_IPV6, IPV6_V6ONLY, &opt_one, sizeof opt_one) == -1)
         log_fatal("Failed to set IPV6_V6ONLY on UDP socket: %s", logf_errno());
 
 #if defined IPV6_TCLASS && defined IPTOS_LOWDELAY
@@ -134,7 +197,97 @@ static void udp_sock_opts_v6(const int sock) {
         log_fatal("Failed to set IPV6_RECVPKTINFO on UDP socket: %s", logf_errno());
 }
 
-bool udp_sock_setup(dns_addr_t *addrconf) {
+#if defined SO_ATTACH_REUSEPORT_CBPF && defined SKF_AD_CPU
+
+// Multiplicative hash constant for client subnets
+#define STEER_HASH_MULT 0x9E3779B1U
+
+// Client subnet hash: the /24 for IPv4, the /56 for IPv6
+F_NONNULL
+static unsigned steer_prog_client(struct sock_filter* prog, const bool isv6, const unsigned nsocks) {
+    dmn_assert(prog);
+    unsigned i = 0;
+    if(isv6) {
+        prog[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_NET_OFF + 8);
+        prog[i++] = (struct sock_filter)BPF_STMT(BPF_MISC|BPF_TAX, 0);
+        prog[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_NET_OFF + 12);
+        prog[i++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0xFFFFFF00U);
+        prog[i++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0);
+    }
+    else {
+        prog[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_NET_OFF + 12);
+        prog[i++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0xFFFFFF00U);
+    }
+    prog[i++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_MUL|BPF_K, STEER_HASH_MULT);
+    prog[i++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_RSH|BPF_K, 16);
+    prog[i++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_MOD|BPF_K, nsocks);
+    prog[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_A, 0);
+    return i;
+}
+
+// Receiving CPU: with pinned threads, the socket whose thread is pinned
+//  to that CPU (else the kernel's hash), otherwise simply CPU % nsocks
+F_NONNULL
+static unsigned steer_prog_cpu(struct sock_filter* prog, const dns_addr_t* addrconf, const unsigned nsocks) {
+    dmn_assert(prog); dmn_assert(addrconf);
+    unsigned i = 0;
+    prog[i++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+
+    // Socket index within the reuseport group is its bind() order, which
+    //  is the order of this address's UDP entries in dns_threads
+    unsigned sidx = 0;
+    bool pinned = false;
+    const unsigned num_socks = gconfig.num_dns_threads;
+    for(unsigned j = 0; j < num_socks; j++) {
+        const dns_thread_t* t = &gconfig.dns_threads[j];
+        if(!t->is_udp || t->ac != addrconf)
+            continue;
+        if(t->cpu >= 0) {
+            prog[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, (unsigned)t->cpu, 0, 1);
+            prog[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, sidx);
+            pinned = true;
+        }
+        sidx++;
+    }
+    dmn_assert(sidx == nsocks);
+
+    if(pinned) {
+        // Out of range, the kernel falls back to its own hash
+        prog[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, nsocks);
+    }
+    else {
+        prog[i++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_MOD|BPF_K, nsocks);
+        prog[i++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_A, 0);
+    }
+    return i;
+}
+
+// Attaches the steering program for the address's reuseport group.  This
+//  is done before bind() on every socket of the group: the first socket
+//  bound creates the group with the program, and the rest join it.
+F_NONNULL
+static void udp_attach_steering(const int sock, const dns_addr_t* addrconf, const bool isv6) {
+    dmn_assert(addrconf);
+
+    const unsigned nsocks = addrconf->udp_threads;
+    struct sock_filter prog[2 * nsocks + 10];
+    struct sock_fprog fprog;
+    fprog.filter = prog;
+    fprog.len = addrconf->udp_reuseport_steer == UDP_STEER_CLIENT
+        ? steer_prog_client(prog, isv6, nsocks)
+        : steer_prog_cpu(prog, addrconf, nsocks);
+    dmn_assert(fprog.len <= sizeof(prog) / sizeof(prog[0]));
+
+    if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof fprog) == -1)
+        log_warn("Failed to attach SO_REUSEPORT steering program on UDP socket %s, using the default balancing: %s", logf_anysin(&addrconf->addr), logf_errno());
+}
+
+#endif // SO_ATTACH_REUSEPORT_CBPF && SKF_AD_CPU
+
+bool udp_sock_setup(dns_thread_t* t) {
+    dmn_assert(t);
+
+    dns_addr_t* addrconf = t->ac;
     dmn_assert(addrconf);
 
     const anysin_t* asin = &addrconf->addr;
@@ -143,16 +296,76 @@ bool udp_sock_setup(dns_addr_t *addrconf) {
     if((!has_mmsg() || RUNNING_ON_VALGRIND) && addrconf->udp_recv_width > 1)
         addrconf->udp_recv_width = 1;
 
+    // udp_recv_width_min of zero (or anything above udp_recv_width)
+    //  means a fixed width, no adaptation
+    if(!addrconf->udp_recv_width_min || addrconf->udp_recv_width_min > addrconf->udp_recv_width)
+        addrconf->udp_recv_width_min = addrconf->udp_recv_width;
+
     const bool isv6 = asin->sa.sa_family == AF_INET6 ? true : false;
     dmn_assert(isv6 || asin->sa.sa_family == AF_INET);
 
-    const int sock = socket(isv6 ? PF_INET6 : PF_INET, SOCK_DGRAM, gdnsd_getproto_udp());
+    // A socket received via restart_handoff is already bound, but
+    //  still gets the options below for the current config, except for
+    //  those which only matter at bind() time (SO_REUSEADDR,
+    //  SO_REUSEPORT, IPV6_V6ONLY).  handoff_take_sock() only gave us
+    //  one with SO_REUSEPORT if we need it.
+    const bool inherited = (t->sock >= 0);
+    const int sock = inherited ? t->sock : socket(isv6 ? PF_INET6 : PF_INET, SOCK_DGRAM, gdnsd_getproto_udp());
     if(sock == -1) log_fatal("Failed to create IPv%c UDP socket: %s", isv6 ? '6' : '4', logf_errno());
 
     const int opt_one = 1;
-    if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt_one, sizeof opt_one) == -1)
+    if(!inherited && setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt_one, sizeof opt_one) == -1)
         log_fatal("Failed to set SO_REUSEADDR on UDP socket: %s", logf_errno());
 
+    // Multiple threads per address each get their own socket bound
+    //  to the same address, and the kernel balances between them
+    if(!inherited && addrconf->udp_threads > 1) {
+#ifdef SO_REUSEPORT
+        if(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt_one, sizeof opt_one) == -1)
+            log_fatal("Failed to set SO_REUSEPORT on UDP socket: %s", logf_errno());
+#else
+        log_fatal("udp_threads > 1 for %s is not supported on this platform (no SO_REUSEPORT)", logf_anysin(asin));
+#endif
+    }
+
+    if(addrconf->udp_reuseport_steer != UDP_STEER_NONE && addrconf->udp_threads > 1) {
+#if defined SO_ATTACH_REUSEPORT_CBPF && defined SKF_AD_CPU
+        udp_attach_steering(sock, addrconf, isv6);
+#else
+        log_warn("udp_reuseport_steer for %s is not supported on this platform (no SO_ATTACH_REUSEPORT_CBPF), ignoring", logf_anysin(asin));
+#endif
+    }
+
+    if(addrconf->udp_busy_poll_usecs) {
+#ifdef SO_BUSY_POLL
+        const int opt_usecs = addrconf->udp_busy_poll_usecs;
+        if(setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &opt_usecs, sizeof opt_usecs) == -1)
+            log_warn("Failed to set SO_BUSY_POLL on UDP socket %s: %s", logf_anysin(asin), logf_errno());
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+        if(setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &opt_one, sizeof opt_one) == -1)
+            log_warn("Failed to set SO_PREFER_BUSY_POLL on UDP socket %s: %s", logf_anysin(asin), logf_errno());
+#endif
+    }
+
+    if(gconfig.udp_latency_stats) {
+#ifdef SO_TIMESTAMPNS
+        if(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &opt_one, sizeof opt_one) == -1)
+            log_warn("Failed to set SO_TIMESTAMPNS on UDP socket %s: %s", logf_anysin(asin), logf_errno());
+#else
+        log_warn("udp_latency_stats is not supported on this platform (no SO_TIMESTAMPNS), ignoring");
+#endif
+    }
+
+    // With thread_cpus, SO_REUSEPORT prefers the socket whose owning
+    //  thread is pinned to the CPU that received the packet
+    if(t->cpu >= 0) {
+#ifdef SO_INCOMING_CPU
+        if(setsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &t->cpu, sizeof t->cpu) == -1)
+            log_warn("Failed to set SO_INCOMING_CPU on UDP socket %s: %s", logf_anysin(asin), logf_errno());
+#endif
+    }
+
     int opt_size;
     socklen_t size_size = sizeof(opt_size);
 
@@ -211,15 +424,15 @@ bool udp_sock_setup(dns_addr_t *addrconf) {
     }
 
     if(isv6)
-        udp_sock_opts_v6(sock);
+        udp_sock_opts_v6(sock, inherited);
     else
         udp_sock_opts_v4(sock, gdnsd_anysin_is_anyaddr(asin));
 
-    addrconf->udp_sock = sock;
+    t->sock = sock;
 
-    if(bind(sock, &asin->sa, asin->len)) {
+    if(!inherited && bind(sock, &asin->sa, asin->len)) {
         if(addrconf->late_bind_secs && errno == EADDRNOTAVAIL) {
-            addrconf->udp_need_late_bind = 1;
+            t->need_late_bind = true;
             log_info("UDP DNS socket %s not yet available, will attempt late bind every %u seconds", logf_anysin(asin), addrconf->late_bind_secs);
             return ntohs(isv6 ? asin->sin6.sin6_port : asin->sin.sin_port) < 1024 ? true : false;
         }
@@ -241,6 +454,7 @@ static void mainloop(const int fd, dnspacket_context_t* pctx, const bool use_cms
     dmn_assert(pctx);
 
     const int cmsg_size = use_cmsg ? CMSG_BUFSIZE : 1;
+    const bool lat_stats = gconfig.udp_latency_stats;
 
     anysin_t asin;
     struct iovec iov = {
@@ -256,16 +470,24 @@ static void mainloop(const int fd, dnspacket_context_t* pctx, const bool use_cms
     msg_hdr.msg_iovlen     = 1;
     msg_hdr.msg_control    = use_cmsg ? cmsg_buf : NULL;
 
+    satom_set(&pctx->stats->p.udp.recv_width, 1);
+
     while(1) {
         iov.iov_len = DNS_RECV_SIZE;
         msg_hdr.msg_controllen = cmsg_size;
         msg_hdr.msg_namelen    = ANYSIN_MAXLEN;
         msg_hdr.msg_flags      = 0;
         const int buf_in_len = recvmsg(fd, &msg_hdr, 0);
-        if(likely(buf_in_len >= 0)) {
+        if(unlikely(buf_in_len >= 0 && udp_pkt_is_junk(iov.iov_base, buf_in_len))) {
+            udp_count_junk(pctx->stats, asin.sa.sa_family == AF_INET6);
+        }
+        else if(likely(buf_in_len >= 0)) {
             asin.len = msg_hdr.msg_namelen;
+            const uint64_t rx_ts = lat_stats ? udp_cmsg_take_rx_ts(&msg_hdr) : 0;
             iov.iov_len = process_dns_query(pctx, &asin, (void*)iov.iov_base, buf_in_len);
             if(likely(iov.iov_len)) {
+                if(lat_stats)
+                    udp_record_latency(pctx->stats, rx_ts, udp_rx_ts_now());
                 const int sent = sendmsg(fd, &msg_hdr, 0);
                 if(unlikely(sent < 0)) {
                     satom_inc(&pctx->stats->p.udp.sendfail);
@@ -299,129 +521,407 @@ static bool has_mmsg(void) {
     return rv;
 }
 
-F_NORETURN F_NONNULL
-static void mainloop_mmsg(const unsigned width, const int fd, dnspacket_context_t* pctx, const bool use_cmsg) {
-    dmn_assert(pctx);
-
-    const int cmsg_size = use_cmsg ? CMSG_BUFSIZE : 1;
+// Adaptive recvmmsg() width: the width doubles after this many
+//  consecutive completely-full batches...
+#define WIDTH_GROW_STREAK 2U
+// ... and halves after this many consecutive batches which
+//  filled no more than a quarter of the current width.
+#define WIDTH_SHRINK_STREAK 64U
+
+// Buffers and adaptive-width state for recvmmsg()/sendmmsg() on one socket
+typedef struct {
+    unsigned width;     // configured (max) width, which the arrays are sized for
+    unsigned min_width; // lower bound for cur_width
+    unsigned cur_width; // width actually in use
+    unsigned full_streak;
+    unsigned sparse_streak;
+    int cmsg_size;
+    bool use_cmsg;
+    uint8_t** buf;
+    unsigned* lens;
+    struct iovec* iov;
+    struct mmsghdr* dgrams;
+    char* cmsg_buf;
+    anysin_t* asin;
+    uint64_t* rx_ts; // only with udp_latency_stats
+} mmsg_t;
+
+F_MALLOC F_WUNUSED
+static mmsg_t* mmsg_new(const unsigned width, const unsigned min_width, const bool use_cmsg) {
+    dmn_assert(min_width && min_width <= width);
+
+    mmsg_t* m = malloc(sizeof(mmsg_t));
+    m->width = width;
+    m->min_width = min_width;
+    // When min_width == width, this is just the old fixed-width behavior
+    m->cur_width = width;
+    m->full_streak = 0;
+    m->sparse_streak = 0;
+    m->use_cmsg = use_cmsg;
+    m->cmsg_size = use_cmsg ? CMSG_BUFSIZE : 1;
+    m->buf = malloc(width * sizeof(uint8_t*));
+    m->lens = malloc(width * sizeof(unsigned));
+    m->iov = malloc(width * sizeof(struct iovec));
+    m->dgrams = malloc(width * sizeof(struct mmsghdr));
+    m->cmsg_buf = malloc(width * m->cmsg_size);
+    m->asin = malloc(width * sizeof(anysin_t));
+    m->rx_ts = gconfig.udp_latency_stats ? malloc(width * sizeof(uint64_t)) : NULL;
 
     // gconfig.max_response, rounded up to the next nearest multiple of the page size
     const long pgsz = sysconf(_SC_PAGESIZE);
     const unsigned max_rounded = gconfig.max_response - (gconfig.max_response % pgsz) + pgsz;
 
-    uint8_t* buf[width];
-    struct iovec iov[width][1];
-    struct mmsghdr dgrams[width];
-    char cmsg_buf[width][cmsg_size];
-    anysin_t asin[width];
-
     /* Set up packet buffers */
     uint8_t* pbuf = mmap(NULL, max_rounded * width, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
 
     for (unsigned i = 0; i < width; i++)
-        iov[i][0].iov_base = buf[i] = pbuf + (i * max_rounded);
+        m->iov[i].iov_base = m->buf[i] = pbuf + (i * max_rounded);
 
-    while(1) {
-        /* Set up msg_hdr stuff: moving initialization inside of the loop was
-             necessitated by the memmove() below */
-        for (unsigned i = 0; i < width; i++) {
-            iov[i][0].iov_len = DNS_RECV_SIZE;
-            dgrams[i].msg_hdr.msg_iov        = iov[i];
-            dgrams[i].msg_hdr.msg_iovlen     = 1;
-            dgrams[i].msg_hdr.msg_name       = &asin[i].sa;
-            dgrams[i].msg_hdr.msg_namelen    = ANYSIN_MAXLEN;
-            dgrams[i].msg_hdr.msg_control    = use_cmsg ? cmsg_buf[i] : NULL;
-            dgrams[i].msg_hdr.msg_controllen = cmsg_size;
-            dgrams[i].msg_hdr.msg_flags      = 0;
+    return m;
+}
+
+F_NONNULL
+static void mmsg_adapt_width(mmsg_t* m, dnspacket_context_t* pctx, const unsigned pkts) {
+    dmn_assert(m); dmn_assert(pctx);
+
+    if(pkts == m->cur_width) {
+        m->sparse_streak = 0;
+        if(++m->full_streak >= WIDTH_GROW_STREAK && m->cur_width < m->width) {
+            m->cur_width = m->cur_width * 2 > m->width ? m->width : m->cur_width * 2;
+            satom_set(&pctx->stats->p.udp.recv_width, m->cur_width);
+            m->full_streak = 0;
         }
+    }
+    else if(pkts * 4 <= m->cur_width) {
+        m->full_streak = 0;
+        if(++m->sparse_streak >= WIDTH_SHRINK_STREAK && m->cur_width > m->min_width) {
+            m->cur_width = m->cur_width / 2 < m->min_width ? m->min_width : m->cur_width / 2;
+            satom_set(&pctx->stats->p.udp.recv_width, m->cur_width);
+            m->sparse_streak = 0;
+        }
+    }
+    else {
+        m->full_streak = 0;
+        m->sparse_streak = 0;
+    }
+}
 
-        int pkts = recvmmsg(fd, dgrams, width, MSG_WAITFORONE, NULL);
-        dmn_assert(pkts <= (int)width);
-        if(likely(pkts > 0)) {
-            for(int i = 0; i < pkts; i++) {
-                asin[i].len = dgrams[i].msg_hdr.msg_namelen;
-                iov[i][0].iov_len = process_dns_query(pctx, &asin[i], buf[i], dgrams[i].msg_len);
-            }
+// Receives one batch of up to m->cur_width requests from fd, and sends
+//  all of the responses.  retval is the count of requests received,
+//  or -1 with errno set if recvmmsg() failed.
+F_NONNULL
+static int mmsg_run(mmsg_t* m, const int fd, dnspacket_context_t* pctx, const int flags) {
+    dmn_assert(m); dmn_assert(pctx);
+
+    struct mmsghdr* dgrams = m->dgrams;
+
+    /* Set up msg_hdr stuff: moving initialization inside of the loop was
+         necessitated by the memmove() below */
+    for (unsigned i = 0; i < m->cur_width; i++) {
+        m->iov[i].iov_len = DNS_RECV_SIZE;
+        dgrams[i].msg_hdr.msg_iov        = &m->iov[i];
+        dgrams[i].msg_hdr.msg_iovlen     = 1;
+        dgrams[i].msg_hdr.msg_name       = &m->asin[i].sa;
+        dgrams[i].msg_hdr.msg_namelen    = ANYSIN_MAXLEN;
+        dgrams[i].msg_hdr.msg_control    = m->use_cmsg ? &m->cmsg_buf[i * m->cmsg_size] : NULL;
+        dgrams[i].msg_hdr.msg_controllen = m->cmsg_size;
+        dgrams[i].msg_hdr.msg_flags      = 0;
+    }
 
-            /* This block adjusts the array of mmsg entries to account for skips where
-             *   process_query() decided we don't owe the sender a response packet.
-             */
-            /* This could be far simpler if sendmmsg() had an interface for skipping packets,
-             *   e.g. a msg_flags flag that indicates the sendmmsg() internal loop should take
-             *   no action for this entry, but still count it in the total number of successes
-             */
-            {
-                int i = 0;
-                while(i < pkts) {
-                    if(unlikely(!dgrams[i].msg_hdr.msg_iov[0].iov_len)) {
-                        const int next = i + 1;
-                        if(next < pkts) {
-                            memmove(&dgrams[i], &dgrams[next], sizeof(struct mmsghdr) * (pkts - next));
-                        }
-                        pkts--;
-                    }
-                    else {
-                        i++;
-                    }
-                }
-            }
+    int pkts = recvmmsg(fd, dgrams, m->cur_width, flags, NULL);
+    dmn_assert(pkts <= (int)m->cur_width);
+    if(unlikely(pkts <= 0))
+        return -1;
 
-            struct mmsghdr* dgptr = dgrams;
-            while(pkts) {
-                int sent = sendmmsg(fd, dgptr, pkts, 0);
-                dmn_assert(sent != 0);
-                dmn_assert(sent <= pkts);
-                if(unlikely(sent < pkts)) {
-                    int sockerr;
-                    socklen_t sock_len;
-                    getsockopt(fd, SOL_SOCKET, SO_ERROR, &sockerr, &sock_len);
-                    satom_inc(&pctx->stats->p.udp.sendfail);
-                    if(sent < 0) sent = 0;
-                    log_err("UDP sendmmsg() of %li bytes to client %s failed: %s", dgptr[sent].msg_hdr.msg_iov[0].iov_len, logf_anysin(dgptr[sent].msg_hdr.msg_name), logf_errnum(sockerr));
-                    dgptr += sent; // skip past the successes
-                    dgptr++; // skip the failed one too
-                    pkts--; // drop one count for the failed message
+    const int rv = pkts;
+
+    unsigned bucket = 0;
+    while(pkts >> (bucket + 1))
+        bucket++;
+    dmn_assert(bucket < UDP_BATCH_BUCKETS);
+    satom_inc(&pctx->stats->p.udp.batch[bucket]);
+
+    if(m->min_width < m->width)
+        mmsg_adapt_width(m, pctx, pkts);
+
+    for(int i = 0; i < pkts; i++) {
+        m->asin[i].len = dgrams[i].msg_hdr.msg_namelen;
+        m->lens[i] = dgrams[i].msg_len;
+        if(unlikely(udp_pkt_is_junk(m->buf[i], m->lens[i]))) {
+            udp_count_junk(pctx->stats, m->asin[i].sa.sa_family == AF_INET6);
+            m->lens[i] = 0; // skipped by process_dns_query_batch()
+        }
+        if(m->rx_ts)
+            m->rx_ts[i] = udp_cmsg_take_rx_ts(&dgrams[i].msg_hdr);
+    }
+
+    process_dns_query_batch(pctx, pkts, m->asin, m->buf, m->lens);
+
+    for(int i = 0; i < pkts; i++)
+        m->iov[i].iov_len = m->lens[i];
+
+    if(m->rx_ts) {
+        const uint64_t now = udp_rx_ts_now();
+        for(int i = 0; i < pkts; i++)
+            if(m->lens[i])
+                udp_record_latency(pctx->stats, m->rx_ts[i], now);
+    }
+
+    /* This block adjusts the array of mmsg entries to account for skips where
+     *   process_query() decided we don't owe the sender a response packet.
+     */
+    /* This could be far simpler if sendmmsg() had an interface for skipping packets,
+     *   e.g. a msg_flags flag that indicates the sendmmsg() internal loop should take
+     *   no action for this entry, but still count it in the total number of successes
+     */
+    {
+        int i = 0;
+        while(i < pkts) {
+            if(unlikely(!dgrams[i].msg_hdr.msg_iov[0].iov_len)) {
+                const int next = i + 1;
+                if(next < pkts) {
+                    memmove(&dgrams[i], &dgrams[next], sizeof(struct mmsghdr) * (pkts - next));
                 }
-                pkts -= sent; // drop the count of all successes
+                pkts--;
+            }
+            else {
+                i++;
             }
         }
-        else {
+    }
+
+    struct mmsghdr* dgptr = dgrams;
+    while(pkts) {
+        int sent = sendmmsg(fd, dgptr, pkts, 0);
+        dmn_assert(sent != 0);
+        dmn_assert(sent <= pkts);
+        if(unlikely(sent < pkts)) {
+            int sockerr;
+            socklen_t sock_len;
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &sockerr, &sock_len);
+            satom_inc(&pctx->stats->p.udp.sendfail);
+            if(sent < 0) sent = 0;
+            log_err("UDP sendmmsg() of %li bytes to client %s failed: %s", dgptr[sent].msg_hdr.msg_iov[0].iov_len, logf_anysin(dgptr[sent].msg_hdr.msg_name), logf_errnum(sockerr));
+            dgptr += sent; // skip past the successes
+            dgptr++; // skip the failed one too
+            pkts--; // drop one count for the failed message
+        }
+        pkts -= sent; // drop the count of all successes
+    }
+
+    return rv;
+}
+
+F_NONNULL
+static uint64_t busy_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+// With udp_busy_poll_usecs, spin on non-blocking receives for up to that
+//  long before blocking, trading CPU for wakeup latency.  Returns like
+//  mmsg_run().
+F_NONNULL
+static int mmsg_run_busy(mmsg_t* m, const int fd, dnspacket_context_t* pctx, const uint64_t spin_ns) {
+    dmn_assert(m); dmn_assert(pctx);
+
+    const uint64_t start = busy_now_ns();
+    do {
+        const int pkts = mmsg_run(m, fd, pctx, MSG_DONTWAIT);
+        if(pkts >= 0) {
+            satom_inc(&pctx->stats->p.udp.busy_spin);
+            return pkts;
+        }
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+            return pkts;
+    } while(busy_now_ns() - start < spin_ns);
+
+    satom_inc(&pctx->stats->p.udp.busy_sleep);
+    return mmsg_run(m, fd, pctx, MSG_WAITFORONE);
+}
+
+F_NORETURN F_NONNULL
+static void mainloop_mmsg(const dns_addr_t* addrconf, const int fd, dnspacket_context_t* pctx, const bool use_cmsg) {
+    dmn_assert(addrconf); dmn_assert(pctx);
+
+    mmsg_t* m = mmsg_new(addrconf->udp_recv_width, addrconf->udp_recv_width_min, use_cmsg);
+    satom_set(&pctx->stats->p.udp.recv_width, m->cur_width);
+
+    const uint64_t spin_ns = (uint64_t)addrconf->udp_busy_poll_usecs * 1000U;
+
+    while(1) {
+        const int pkts = spin_ns
+            ? mmsg_run_busy(m, fd, pctx, spin_ns)
+            : mmsg_run(m, fd, pctx, MSG_WAITFORONE);
+        if(unlikely(pkts < 0)) {
             satom_inc(&pctx->stats->p.udp.recvfail);
             log_err("UDP recvmmsg() error: %s", logf_errno());
         }
     }
 }
 
+#if defined HAVE_EPOLL_CTL && defined HAVE_SYS_EPOLL_H
+#define HAVE_UDP_POOL 1
+
+// Upper bound on recvmmsg() batches drained from one ready socket
+//  before moving on to the next, so that one busy socket can't
+//  starve the rest of a pool worker's sockets.
+#define POOL_DRAIN_BATCHES 8U
+
+typedef struct {
+    const dns_thread_t* t;
+    mmsg_t* m;
+    time_t next_bind; // only meaningful while t->need_late_bind
+    bool pending;     // waiting on late bind()
+} pool_sock_t;
+
+F_NONNULL
+static void pool_sock_add(const int efd, pool_sock_t* ps) {
+    dmn_assert(ps);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = ps;
+    if(epoll_ctl(efd, EPOLL_CTL_ADD, ps->t->sock, &ev))
+        log_fatal("epoll_ctl() failed for UDP socket %s: %s", logf_anysin(&ps->t->ac->addr), logf_errno());
+}
+
+// Retries late bind() for all pending sockets whose retry time has come,
+//  adding the successes to epoll.  Returns the epoll_wait() timeout (ms)
+//  until the next retry is due, or -1 if no sockets remain pending.
+F_NONNULL
+static int pool_late_bind(const int efd, pool_sock_t* socks, const unsigned nsocks) {
+    dmn_assert(socks);
+
+    const time_t now = time(NULL);
+    time_t next = 0;
+    for(unsigned i = 0; i < nsocks; i++) {
+        pool_sock_t* ps = &socks[i];
+        if(!ps->pending)
+            continue;
+        const anysin_t* asin = &ps->t->ac->addr;
+        if(ps->next_bind <= now) {
+            if(!bind(ps->t->sock, &asin->sa, asin->len)) {
+                log_info("Late bind() of UDP socket to %s succeeded, serving requests now", logf_anysin(asin));
+                ps->pending = false;
+                pool_sock_add(efd, ps);
+                continue;
+            }
+            if(errno != EADDRNOTAVAIL) {
+                log_err("Failed late bind() of UDP socket to %s: %s.  Late bind attempts for this socket will no longer be attempted!", logf_anysin(asin), logf_errno());
+                ps->pending = false;
+                continue;
+            }
+            ps->next_bind = now + ps->t->ac->late_bind_secs;
+        }
+        if(!next || ps->next_bind < next)
+            next = ps->next_bind;
+    }
+
+    return next ? (int)(next - now) * 1000 : -1;
+}
+
+F_NORETURN
+static void pool_mainloop(const unsigned worker) {
+    dnspacket_context_t* pctx = dnspacket_context_new(worker, true);
+
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+
+    const unsigned num_socks = gconfig.num_dns_threads;
+    unsigned nsocks = 0;
+    for(unsigned i = 0; i < num_socks; i++) {
+        const dns_thread_t* t = &gconfig.dns_threads[i];
+        if(t->is_udp && t->threadnum == worker)
+            nsocks++;
+    }
+    dmn_assert(nsocks);
+
+    const int efd = epoll_create(nsocks);
+    if(efd < 0)
+        log_fatal("epoll_create() failed: %s", logf_errno());
+
+    pool_sock_t* socks = calloc(nsocks, sizeof(pool_sock_t));
+    unsigned max_width = 0;
+    bool any_pending = false;
+    unsigned sidx = 0;
+    for(unsigned i = 0; i < num_socks; i++) {
+        const dns_thread_t* t = &gconfig.dns_threads[i];
+        if(!t->is_udp || t->threadnum != worker)
+            continue;
+        const dns_addr_t* addrconf = t->ac;
+        pool_sock_t* ps = &socks[sidx++];
+        ps->t = t;
+        ps->m = mmsg_new(addrconf->udp_recv_width, addrconf->udp_recv_width_min, needs_cmsg(&addrconf->addr));
+        if(addrconf->udp_recv_width > max_width)
+            max_width = addrconf->udp_recv_width;
+        if(t->need_late_bind) {
+            ps->pending = true;
+            any_pending = true;
+        }
+        else {
+            pool_sock_add(efd, ps);
+        }
+    }
+    dmn_assert(sidx == nsocks);
+
+    log_info("UDP pool thread %u serving %u socket(s)", worker, nsocks);
+    satom_set(&pctx->stats->p.udp.recv_width, max_width);
+
+    struct epoll_event evs[nsocks];
+    int timeout = any_pending ? 0 : -1;
+    while(1) {
+        const int nevs = epoll_wait(efd, evs, nsocks, timeout);
+        if(unlikely(nevs < 0)) {
+            if(errno != EINTR)
+                log_err("UDP pool epoll_wait() error: %s", logf_errno());
+            continue;
+        }
+
+        for(int i = 0; i < nevs; i++) {
+            pool_sock_t* ps = evs[i].data.ptr;
+            for(unsigned b = 0; b < POOL_DRAIN_BATCHES; b++) {
+                const unsigned width = ps->m->cur_width;
+                const int pkts = mmsg_run(ps->m, ps->t->sock, pctx, MSG_DONTWAIT);
+                if(pkts < 0) {
+                    if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                        satom_inc(&pctx->stats->p.udp.recvfail);
+                        log_err("UDP recvmmsg() error: %s", logf_errno());
+                    }
+                    break;
+                }
+                if((unsigned)pkts < width)
+                    break;
+            }
+        }
+
+        if(timeout >= 0)
+            timeout = pool_late_bind(efd, socks, nsocks);
+    }
+}
+
+#endif // HAVE_EPOLL_CTL && HAVE_SYS_EPOLL_H
+
 #else // HAVE_SENDMMSG
 
 static bool has_mmsg(void) { return false; }
 
 #endif // HAVE_SENDMMSG
 
-// We need to use cmsg stuff in the case of any IPv6 address (at minimum,
-//  to copy the flow label correctly, if not the interface + source addr),
-//  as well as the IPv4 any-address (for correct source address).
-F_NONNULL F_PURE
-static bool needs_cmsg(const anysin_t* asin) {
-    dmn_assert(asin);
-    dmn_assert(asin->sa.sa_family == AF_INET6 || asin->sa.sa_family == AF_INET);
-    return (asin->sa.sa_family == AF_INET6 || gdnsd_anysin_is_anyaddr(asin))
-        ? true
-        : false;
-}
-
 F_NORETURN
-void* dnsio_udp_start(void* addrconf_asvoid) {
-    dmn_assert(addrconf_asvoid);
-    const dns_addr_t* addrconf = (const dns_addr_t*) addrconf_asvoid;
+void* dnsio_udp_start(void* thread_asvoid) {
+    dmn_assert(thread_asvoid);
+    const dns_thread_t* t = (const dns_thread_t*) thread_asvoid;
+    dmn_assert(t->is_udp);
+    const dns_addr_t* addrconf = t->ac;
 
-    dnspacket_context_t* pctx = dnspacket_context_new(addrconf->udp_threadnum, true);
+    dnspacket_context_t* pctx = dnspacket_context_new(t->threadnum, true);
 
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
-    if(addrconf->udp_need_late_bind) {
+    if(t->need_late_bind) {
         const anysin_t* asin = &addrconf->addr;
-        while(bind(addrconf->udp_sock, &asin->sa, asin->len)) {
+        while(bind(t->sock, &asin->sa, asin->len)) {
             if(errno != EADDRNOTAVAIL) {
                 log_err("Failed late bind() of UDP socket to %s: %s.  This listener thread is now shutting down.  Late bind attempts for this socket will no longer be attempted!", logf_anysin(asin), logf_errno());
                 pthread_exit(NULL);
@@ -433,15 +933,43 @@ void* dnsio_udp_start(void* addrconf_asvoid) {
 
     const bool need_cmsg = needs_cmsg(&addrconf->addr);
 
+#if USE_IO_URING
+    if(addrconf->udp_io_uring) {
+        log_info("io_uring enabled for UDP socket %s", logf_anysin(&addrconf->addr));
+        dnsio_uring_udp_mainloop(t->sock, pctx, need_cmsg);
+        log_warn("io_uring unavailable for UDP socket %s, falling back to recvmsg()/recvmmsg()", logf_anysin(&addrconf->addr));
+    }
+#endif
+
 #ifdef HAVE_SENDMMSG
     if(addrconf->udp_recv_width > 1) {
-        log_info("sendmmsg() with a width of %u enabled for UDP socket %s",
-            addrconf->udp_recv_width, logf_anysin(&addrconf->addr));
-        mainloop_mmsg(addrconf->udp_recv_width, addrconf->udp_sock, pctx, need_cmsg);
+        if(addrconf->udp_recv_width_min < addrconf->udp_recv_width)
+            log_info("sendmmsg() with an adaptive width of %u-%u enabled for UDP socket %s",
+                addrconf->udp_recv_width_min, addrconf->udp_recv_width, logf_anysin(&addrconf->addr));
+        else
+            log_info("sendmmsg() with a width of %u enabled for UDP socket %s",
+                addrconf->udp_recv_width, logf_anysin(&addrconf->addr));
+        if(addrconf->udp_busy_poll_usecs)
+            log_info("Busy polling for up to %u usecs per receive enabled for UDP socket %s",
+                addrconf->udp_busy_poll_usecs, logf_anysin(&addrconf->addr));
+        mainloop_mmsg(addrconf, t->sock, pctx, need_cmsg);
     }
     else
 #endif
     {
-        mainloop(addrconf->udp_sock, pctx, need_cmsg);
+        mainloop(t->sock, pctx, need_cmsg);
     }
 }
+
+F_NORETURN
+void* dnsio_udp_pool_start(void* worker_asvoid) {
+    const unsigned worker = (unsigned)(uintptr_t)worker_asvoid;
+    dmn_assert(worker < gconfig.udp_pool_threads);
+
+#ifdef HAVE_UDP_POOL
+    if(has_mmsg())
+        pool_mainloop(worker);
+#endif
+
+    log_fatal("udp_pool_threads requires epoll() and sendmmsg() support, which this system lacks");
+}
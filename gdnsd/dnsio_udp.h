@@ -23,12 +23,58 @@
 #include "config.h"
 #include "gdnsd.h"
 #include "conf.h"
+#include "dnspacket.h"
+#include "dnswire.h"
+
+#include <sys/socket.h>
 
 // retval indicates need for net bind caps, if possible
 F_NONNULL
-bool udp_sock_setup(dns_addr_t *addrconf);
+bool udp_sock_setup(dns_thread_t* t);
 
 F_NONNULL F_NORETURN
-void* dnsio_udp_start(void* addrconf_asvoid);
+void* dnsio_udp_start(void* thread_asvoid);
+
+// udp_latency_stats support, shared with the io_uring engine:
+// Removes the SCM_TIMESTAMPNS control message from a received msghdr
+//  (it's not valid for sendmsg(), and received control data is reused
+//  for the reply), and returns its timestamp in ns, or 0 if absent.
+F_NONNULL
+uint64_t udp_cmsg_take_rx_ts(struct msghdr* mh);
+
+// Current time on the clock used by udp_cmsg_take_rx_ts()
+uint64_t udp_rx_ts_now(void);
+
+// Records a receive-to-reply latency in the stats histogram
+F_NONNULL
+void udp_record_latency(dnspacket_stats_t* stats, const uint64_t rx_ts, const uint64_t now);
+
+// Cheap pre-decode check of a received request's length and fixed
+//  header, shared by all of the UDP receive loops.  True for packets
+//  which decode_query() would only ignore after parsing (and logging)
+//  them: too short for a question, QR or TC set, or QDCOUNT != 1.
+//  The caller drops these, counting them with udp_count_junk().
+F_NONNULL F_PURE
+static inline bool udp_pkt_is_junk(const uint8_t* packet, const unsigned len) {
+    if(unlikely(len < (sizeof(wire_dns_header_t) + 5)))
+        return true;
+    const wire_dns_header_t* hdr = (const wire_dns_header_t*)packet;
+    return unlikely(DNSH_GET_QR(hdr) || DNSH_GET_TC(hdr) || hdr->qdcount != htons(1));
+}
+
+// Junk is still counted as a dropped request (and as v6 if it was),
+//  just as when process_dns_query() ignored it, and also as udp.junk
+F_NONNULL
+static inline void udp_count_junk(dnspacket_stats_t* stats, const bool is_v6) {
+    if(is_v6)
+        satom_inc(&stats->v6);
+    satom_inc(&stats->dropped);
+    satom_inc(&stats->p.udp.junk);
+}
+
+// Worker thread for udp_pool_threads mode, serving all UDP
+//  sockets whose dns_thread_t threadnum is (uintptr_t)worker_asvoid
+F_NORETURN
+void* dnsio_udp_pool_start(void* worker_asvoid);
 
 #endif // _GDNSD_DNSIO_UDP_H
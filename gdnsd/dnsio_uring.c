@@ -0,0 +1,458 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "dnsio_uring.h"
+
+#if USE_IO_URING
+
+#include <stddef.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "conf.h"
+#include "dnswire.h"
+#include "dnsio_udp.h"
+
+/*
+ * This talks to the kernel via the raw io_uring syscalls rather than
+ *  liburing, to avoid a new library dependency for what is a fairly
+ *  small amount of ring bookkeeping.
+ *
+ * One multishot IORING_OP_RECVMSG is kept armed on the socket, selecting
+ *  from a provided buffer ring (IORING_REGISTER_PBUF_RING).  Each buffer
+ *  holds the kernel's io_uring_recvmsg_out header, the source address,
+ *  the control data, and then the payload, which is large enough to hold
+ *  the response so that queries are answered in place.  The buffer is
+ *  handed back to the kernel once the sendmsg() of the response completes.
+ *  All recv completions available at once are processed as a batch, and
+ *  all of the resulting sends go to the kernel in the same io_uring_enter()
+ *  which waits for the next completions.
+ */
+
+// Submission queue size, power of two
+#define UR_SQ_ENTRIES 256U
+// Provided buffers, power of two, max 32768
+#define UR_NBUFS 256U
+// Provided buffer group ID
+#define UR_BGID 0
+// Max requests passed to process_dns_query_batch() at once
+#define UR_BATCH 64U
+// Matches CMSG_BUFSIZE in dnsio_udp.c
+#define UR_CMSG_SIZE 256U
+
+// user_data for the multishot recv, sends carry the buffer id instead
+#define UD_RECV 0xFFFFFFFFFFFFFFFFULL
+
+typedef struct {
+    int fd;
+    int sock;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned cq_mask;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* ring_mem;
+    size_t ring_size;
+    size_t sqes_size;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+    struct io_uring_buf_ring* br;
+    size_t br_size;
+    unsigned br_tail;
+    unsigned bufs_held; // buffers owned by us (in processing or in-flight sends)
+    uint8_t* bufs;
+    size_t bufs_size;
+    unsigned buf_size;
+    struct msghdr recv_hdr;
+    struct msghdr* send_hdrs;
+    struct iovec* send_iovs;
+} uring_t;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+F_NONNULL
+static void uring_destroy(uring_t* u) {
+    dmn_assert(u);
+    if(u->bufs)
+        munmap(u->bufs, u->bufs_size);
+    if(u->br)
+        munmap(u->br, u->br_size);
+    if(u->sqes)
+        munmap(u->sqes, u->sqes_size);
+    if(u->ring_mem)
+        munmap(u->ring_mem, u->ring_size);
+    if(u->fd >= 0)
+        close(u->fd);
+    free(u->send_hdrs);
+    free(u->send_iovs);
+    free(u);
+}
+
+// retval is NULL on failure, with a warning already logged
+F_WUNUSED
+static uring_t* uring_new(const int sock, const bool use_cmsg) {
+    uring_t* u = calloc(1, sizeof(uring_t));
+    u->fd = -1;
+    u->sock = sock;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    // Worst case: every buffer has both a recv and a send completion pending
+    p.cq_entries = UR_NBUFS * 2;
+    u->fd = sys_io_uring_setup(UR_SQ_ENTRIES, &p);
+    if(u->fd < 0) {
+        log_warn("io_uring_setup() failed: %s", logf_errno());
+        goto fail;
+    }
+    if(!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+        log_warn("io_uring: kernel lacks required features (SINGLE_MMAP, NODROP)");
+        goto fail;
+    }
+
+    const size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    const size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    u->ring_mem = mmap(NULL, u->ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if(u->ring_mem == MAP_FAILED) {
+        u->ring_mem = NULL;
+        log_warn("io_uring: mmap() of rings failed: %s", logf_errno());
+        goto fail;
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if(u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        log_warn("io_uring: mmap() of SQEs failed: %s", logf_errno());
+        goto fail;
+    }
+
+    uint8_t* rm = u->ring_mem;
+    u->sq_head = (unsigned*)(rm + p.sq_off.head);
+    u->sq_tail = (unsigned*)(rm + p.sq_off.tail);
+    u->sq_mask = *(unsigned*)(rm + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->cq_head = (unsigned*)(rm + p.cq_off.head);
+    u->cq_tail = (unsigned*)(rm + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)(rm + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(rm + p.cq_off.cqes);
+    u->sq_local_tail = *u->sq_tail;
+
+    // SQ index array is a fixed identity mapping
+    unsigned* sq_array = (unsigned*)(rm + p.sq_off.array);
+    for(unsigned i = 0; i < p.sq_entries; i++)
+        sq_array[i] = i;
+
+    // Per-buffer layout: recvmsg_out header, name, control, payload/response
+    const unsigned cmsg_size = use_cmsg ? UR_CMSG_SIZE : 0;
+    memset(&u->recv_hdr, 0, sizeof(u->recv_hdr));
+    u->recv_hdr.msg_namelen = ANYSIN_MAXLEN;
+    u->recv_hdr.msg_controllen = cmsg_size;
+    u->buf_size = sizeof(struct io_uring_recvmsg_out) + ANYSIN_MAXLEN + cmsg_size + gconfig.max_response;
+    u->buf_size = (u->buf_size + 63U) & ~63U;
+    u->bufs_size = (size_t)u->buf_size * UR_NBUFS;
+    u->bufs = mmap(NULL, u->bufs_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(u->bufs == MAP_FAILED) {
+        u->bufs = NULL;
+        log_warn("io_uring: mmap() of packet buffers failed: %s", logf_errno());
+        goto fail;
+    }
+
+    u->br_size = UR_NBUFS * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(u->br == MAP_FAILED) {
+        u->br = NULL;
+        log_warn("io_uring: mmap() of buffer ring failed: %s", logf_errno());
+        goto fail;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)u->br;
+    reg.ring_entries = UR_NBUFS;
+    reg.bgid = UR_BGID;
+    if(sys_io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+        log_warn("io_uring: registering provided buffer ring failed: %s", logf_errno());
+        goto fail;
+    }
+
+    for(unsigned i = 0; i < UR_NBUFS; i++) {
+        struct io_uring_buf* b = &u->br->bufs[i];
+        b->addr = (uintptr_t)(u->bufs + (size_t)i * u->buf_size);
+        b->len = u->buf_size;
+        b->bid = i;
+    }
+    u->br_tail = UR_NBUFS;
+    __atomic_store_n(&u->br->tail, (uint16_t)u->br_tail, __ATOMIC_RELEASE);
+
+    u->send_hdrs = calloc(UR_NBUFS, sizeof(struct msghdr));
+    u->send_iovs = calloc(UR_NBUFS, sizeof(struct iovec));
+
+    return u;
+
+    fail:
+    uring_destroy(u);
+    return NULL;
+}
+
+// Pushes all queued SQEs to the kernel, and optionally waits for a completion
+F_NONNULL
+static void uring_enter(uring_t* u, const unsigned wait_nr) {
+    dmn_assert(u);
+    __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+    while(1) {
+        const int rv = sys_io_uring_enter(u->fd, u->to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+        if(likely(rv >= 0)) {
+            dmn_assert((unsigned)rv <= u->to_submit);
+            u->to_submit -= rv;
+            return;
+        }
+        if(errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            log_fatal("io_uring_enter() failed: %s", logf_errno());
+        // EAGAIN/EBUSY: the CQ is backed up, and we're about to drain it
+        if(errno != EINTR)
+            return;
+    }
+}
+
+F_NONNULL F_WUNUSED
+static struct io_uring_sqe* uring_get_sqe(uring_t* u) {
+    dmn_assert(u);
+    while(u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+        uring_enter(u, 0);
+    struct io_uring_sqe* sqe = &u->sqes[u->sq_local_tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_local_tail++;
+    u->to_submit++;
+    return sqe;
+}
+
+F_NONNULL
+static void uring_arm_recv(uring_t* u) {
+    dmn_assert(u);
+    struct io_uring_sqe* sqe = uring_get_sqe(u);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = u->sock;
+    sqe->addr = (uintptr_t)&u->recv_hdr;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = UR_BGID;
+    sqe->user_data = UD_RECV;
+}
+
+// Hands a buffer back to the kernel (visible at the next uring_publish_bufs())
+F_NONNULL
+static void uring_recycle(uring_t* u, const unsigned bid) {
+    dmn_assert(u); dmn_assert(bid < UR_NBUFS);
+    struct io_uring_buf* b = &u->br->bufs[u->br_tail & (UR_NBUFS - 1)];
+    b->addr = (uintptr_t)(u->bufs + (size_t)bid * u->buf_size);
+    b->len = u->buf_size;
+    b->bid = bid;
+    u->br_tail++;
+    dmn_assert(u->bufs_held);
+    u->bufs_held--;
+}
+
+F_NONNULL
+static void uring_publish_bufs(uring_t* u) {
+    dmn_assert(u);
+    __atomic_store_n(&u->br->tail, (uint16_t)u->br_tail, __ATOMIC_RELEASE);
+}
+
+// Per-batch state for received requests awaiting processing
+typedef struct {
+    unsigned count;
+    unsigned bids[UR_BATCH];
+    anysin_t asins[UR_BATCH];
+    uint8_t* pkts[UR_BATCH];
+    unsigned lens[UR_BATCH];
+    const struct io_uring_recvmsg_out* outs[UR_BATCH];
+} ur_batch_t;
+
+F_NONNULL
+static void uring_flush_batch(uring_t* u, ur_batch_t* b, dnspacket_context_t* pctx) {
+    dmn_assert(u); dmn_assert(b); dmn_assert(pctx);
+    dmn_assert(b->count);
+
+    unsigned bucket = 0;
+    while(b->count >> (bucket + 1))
+        bucket++;
+    dmn_assert(bucket < UDP_BATCH_BUCKETS);
+    satom_inc(&pctx->stats->p.udp.batch[bucket]);
+
+    process_dns_query_batch(pctx, b->count, b->asins, b->pkts, b->lens);
+    const uint64_t now = gconfig.udp_latency_stats ? udp_rx_ts_now() : 0;
+
+    for(unsigned i = 0; i < b->count; i++) {
+        const unsigned bid = b->bids[i];
+        if(!b->lens[i]) {
+            uring_recycle(u, bid);
+            continue;
+        }
+
+        const struct io_uring_recvmsg_out* out = b->outs[i];
+        uint8_t* name = (uint8_t*)(out + 1);
+        struct iovec* iov = &u->send_iovs[bid];
+        iov->iov_base = b->pkts[i];
+        iov->iov_len = b->lens[i];
+        struct msghdr* mh = &u->send_hdrs[bid];
+        mh->msg_name = name;
+        mh->msg_namelen = b->asins[i].len;
+        mh->msg_iov = iov;
+        mh->msg_iovlen = 1;
+        mh->msg_control = out->controllen ? name + u->recv_hdr.msg_namelen : NULL;
+        mh->msg_controllen = out->controllen;
+        mh->msg_flags = 0;
+        if(gconfig.udp_latency_stats)
+            udp_record_latency(pctx->stats, udp_cmsg_take_rx_ts(mh), now);
+
+        struct io_uring_sqe* sqe = uring_get_sqe(u);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = u->sock;
+        sqe->addr = (uintptr_t)mh;
+        sqe->len = 1;
+        sqe->user_data = bid;
+    }
+
+    b->count = 0;
+}
+
+// Adds the buffer of a recv completion to the batch, or recycles it
+//  right away if it's junk
+F_NONNULL
+static void uring_recv_cqe(uring_t* u, ur_batch_t* b, const struct io_uring_cqe* cqe, dnspacket_context_t* pctx) {
+    dmn_assert(u); dmn_assert(b); dmn_assert(cqe); dmn_assert(pctx);
+    dmn_assert(cqe->flags & IORING_CQE_F_BUFFER);
+    dmn_assert(b->count < UR_BATCH);
+
+    const unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    dmn_assert(bid < UR_NBUFS);
+    u->bufs_held++;
+
+    uint8_t* buf = u->bufs + (size_t)bid * u->buf_size;
+    const struct io_uring_recvmsg_out* out = (const struct io_uring_recvmsg_out*)buf;
+    const uint8_t* name = (const uint8_t*)(out + 1);
+    uint8_t* payload = buf + sizeof(*out) + u->recv_hdr.msg_namelen + u->recv_hdr.msg_controllen;
+
+    // Mimic recvmsg() into a DNS_RECV_SIZE buffer for oversized datagrams
+    unsigned len = out->payloadlen;
+    if(len > DNS_RECV_SIZE)
+        len = DNS_RECV_SIZE;
+
+    if(unlikely(udp_pkt_is_junk(payload, len))) {
+        sa_family_t family;
+        memcpy(&family, name + offsetof(struct sockaddr, sa_family), sizeof(family));
+        udp_count_junk(pctx->stats, family == AF_INET6);
+        uring_recycle(u, bid);
+        return;
+    }
+
+    const unsigned i = b->count++;
+    b->bids[i] = bid;
+    b->outs[i] = out;
+    b->pkts[i] = payload;
+    b->lens[i] = len;
+    const unsigned namelen = out->namelen > ANYSIN_MAXLEN ? ANYSIN_MAXLEN : out->namelen;
+    memcpy(&b->asins[i].sa, name, namelen);
+    b->asins[i].len = namelen;
+}
+
+void dnsio_uring_udp_mainloop(const int fd, dnspacket_context_t* pctx, const bool use_cmsg) {
+    dmn_assert(pctx);
+
+    uring_t* u = uring_new(fd, use_cmsg);
+    if(!u)
+        return;
+
+    satom_set(&pctx->stats->p.udp.recv_width, UR_BATCH);
+
+    ur_batch_t* b = calloc(1, sizeof(ur_batch_t));
+    bool need_arm = true;
+
+    while(1) {
+        // Re-arm the multishot recv once we have buffers to give it
+        if(need_arm && u->bufs_held < UR_NBUFS) {
+            uring_arm_recv(u);
+            need_arm = false;
+        }
+
+        uring_enter(u, 1);
+
+        unsigned head = *u->cq_head;
+        const unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        while(head != tail) {
+            const struct io_uring_cqe* cqe = &u->cqes[head & u->cq_mask];
+            head++;
+            if(cqe->user_data == UD_RECV) {
+                if(!(cqe->flags & IORING_CQE_F_MORE))
+                    need_arm = true;
+                if(unlikely(cqe->res < 0)) {
+                    // ENOBUFS just means all buffers are busy with sends
+                    if(cqe->res != -ENOBUFS) {
+                        satom_inc(&pctx->stats->p.udp.recvfail);
+                        log_err("UDP io_uring recvmsg() error: %s", logf_errnum(-cqe->res));
+                    }
+                    continue;
+                }
+                uring_recv_cqe(u, b, cqe, pctx);
+                if(b->count == UR_BATCH)
+                    uring_flush_batch(u, b, pctx);
+            }
+            else {
+                const unsigned bid = (unsigned)cqe->user_data;
+                if(unlikely(cqe->res < 0)) {
+                    const struct msghdr* mh = &u->send_hdrs[bid];
+                    anysin_t asin;
+                    memcpy(&asin.sa, mh->msg_name, mh->msg_namelen);
+                    asin.len = mh->msg_namelen;
+                    satom_inc(&pctx->stats->p.udp.sendfail);
+                    log_err("UDP io_uring sendmsg() of %li bytes to client %s failed: %s", (long)u->send_iovs[bid].iov_len, logf_anysin(&asin), logf_errnum(-cqe->res));
+                }
+                uring_recycle(u, bid);
+            }
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+        if(b->count)
+            uring_flush_batch(u, b, pctx);
+        uring_publish_bufs(u);
+    }
+}
+
+#endif // USE_IO_URING
@@ -0,0 +1,39 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _GDNSD_DNSIO_URING_H
+#define _GDNSD_DNSIO_URING_H
+
+#include "config.h"
+#include "gdnsd.h"
+#include "dnspacket.h"
+
+#if USE_IO_URING
+
+// Serves UDP requests on fd through io_uring (multishot recvmsg into a
+//  ring of kernel-registered buffers, with batched sendmsg submission).
+// Only returns if the kernel lacks the necessary io_uring features, in
+//  which case a warning has been logged and the caller should fall back
+//  to the recvmsg()/recvmmsg() loops.
+F_NONNULL
+void dnsio_uring_udp_mainloop(const int fd, dnspacket_context_t* pctx, const bool use_cmsg);
+
+#endif // USE_IO_URING
+
+#endif // _GDNSD_DNSIO_URING_H
@@ -30,9 +30,39 @@
 #include "gdnsd-misc.h"
 #include "gdnsd-plugapi-priv.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static const uint8_t chaos_fixed[] = "\xC0\x0C\x00\x10\x00\x03\x00\x00\x00\x00\x00\x06\x05gdnsd";
 static const unsigned chaos_fixed_len = sizeof(chaos_fixed) - 1;
 
+// response_cache_size: answers (the bytes answer_from_db_outer() adds
+//  after the question) larger than this aren't cached, which keeps each
+//  entry to 1KB.  Answers which rotate an rrset are cached as up to
+//  RCACHE_VARIANTS separate entries, each holding one rotation.
+#define RCACHE_DATA 740
+#define RCACHE_VARIANTS 4
+
+struct _rcache_entry_struct {
+    uint32_t hash;         // of lqname, qtype and max_response
+    uint16_t qtype;
+    uint16_t max_response; // c->this_max_response, which the answer's truncation depends on
+    uint32_t rot_base;     // variant 0 only: variant N is rotated by rot_base + N
+    uint16_t len;          // of data
+    uint16_t ancount;
+    uint16_t cname_ancount;
+    uint16_t nscount;
+    uint16_t arcount;
+    uint8_t variant;
+    uint8_t flags1;        // AA and TC bits only
+    uint8_t flags2;        // RCODE
+    bool used;
+    bool rotated;          // other variants of this answer exist
+    uint8_t lqname[256];
+    uint8_t data[RCACHE_DATA];
+};
+
 static pthread_mutex_t stats_init_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t stats_init_cond = PTHREAD_COND_INITIALIZER;
 static unsigned stats_initialized = 0;
@@ -85,10 +115,21 @@ dnspacket_context_t* dnspacket_context_new(const unsigned int this_threadnum, co
     retval->is_udp = is_udp;
     retval->threadnum = this_threadnum;
     retval->addtl_rrsets = malloc(gconfig.max_addtl_rrsets * sizeof(addtl_rrset_t));
-    retval->comptargets = malloc(COMPTARGETS_MAX * sizeof(comptarget_t));
+    retval->comptargets = calloc(COMPTARGETS_SLOTS, sizeof(comptarget_t));
     retval->dync_store = malloc(gconfig.max_cname_depth * 256);
     retval->addtl_store = malloc(gconfig.max_response);
     retval->dynaddr = malloc(sizeof(dynaddr_result_t));
+    if(is_udp && gconfig.rrl_responses_per_sec)
+        retval->rrl = rrl_table_new(retval->rand_state);
+    if(gconfig.response_cache_size) {
+        unsigned size = 1;
+        while(size < gconfig.response_cache_size)
+            size <<= 1;
+        retval->rcache = calloc(size, sizeof(rcache_entry_t));
+        retval->rcache_mask = size - 1;
+    }
+    if(gconfig.dynamic_cache_size)
+        retval->dyncache = dyncache_new(retval->rand_state);
 
     return retval;
 }
@@ -100,47 +141,125 @@ static inline void reset_context(dnspacket_context_t* c) {
         &c->answer_addr_rrset, 0,
         sizeof(dnspacket_context_t) - offsetof(dnspacket_context_t, answer_addr_rrset)
     );
+
+    // Invalidates all of the previous request's compression targets,
+    //  unless the generation wraps, in which case they must really be cleared
+    if(unlikely(!++c->comptarget_gen)) {
+        memset(c->comptargets, 0, COMPTARGETS_SLOTS * sizeof(comptarget_t));
+        c->comptarget_gen = 1;
+    }
 }
 
-// "buf" points to the question section of an input packet.
+// Copies "len" bytes of name data from "src" to "dst", lowercasing A-Z.
+//  Label boundaries don't matter here, as valid label length bytes
+//  (< 0x40) are never in the A-Z range.
 F_NONNULL
-static unsigned int parse_question(dnspacket_context_t* c, uint8_t* lqname, const uint8_t* buf, const unsigned int len) {
-    dmn_assert(c); dmn_assert(lqname); dmn_assert(buf);
+static void lowercase_copy(uint8_t* restrict dst, const uint8_t* restrict src, const unsigned len) {
+    dmn_assert(dst); dmn_assert(src);
+
+    unsigned i = 0;
+#ifdef __SSE2__
+    if(len >= 16) {
+        const __m128i above = _mm_set1_epi8(0x40);
+        const __m128i below = _mm_set1_epi8(0x5B);
+        const __m128i bit = _mm_set1_epi8(0x20);
+        do {
+            // The final block overlaps the previous one rather than
+            //  running off the end of either buffer.  Bytes >= 0x80
+            //  compare as negative, and so aren't matched either.
+            if(i + 16 > len)
+                i = len - 16;
+            const __m128i x = _mm_loadu_si128((const __m128i*)&src[i]);
+            const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(x, above), _mm_cmplt_epi8(x, below));
+            _mm_storeu_si128((__m128i*)&dst[i], _mm_or_si128(x, _mm_and_si128(upper, bit)));
+            i += 16;
+        } while(i < len);
+        return;
+    }
+#endif
+    for(; i < len; i++) {
+        const uint8_t x = src[i];
+        dst[i] = (x < 0x5B && x > 0x40) ? x | 0x20 : x;
+    }
+}
+
+// Parses the uncompressed name at the start of "buf" ("len" bytes of
+//  input) into lqname, lowercased and prefixed with its overall length,
+//  and fills in "labels" for search_ltree().  Returns the length of the
+//  name within buf, or zero with *err set if it's invalid.
+F_NONNULL
+static unsigned parse_qname(uint8_t* restrict lqname, dname_labels_t* restrict labels, const uint8_t* restrict buf, const unsigned len, const char** err) {
+    dmn_assert(lqname); dmn_assert(labels); dmn_assert(buf); dmn_assert(err);
 
-    uint8_t* lqname_ptr = lqname + 1;
+    // Validate the label lengths and record the label offsets, which
+    //  only touches the length bytes
     unsigned pos = 0;
+    unsigned count = 0;
     unsigned llen;
-    while((llen = *lqname_ptr++ = buf[pos++])) {
+    while((llen = buf[pos])) {
         if(unlikely(llen & 0xC0)) {
-            log_pkterr("Label compression detected in question, failing.");
-            pos = 0;
-            break;
+            *err = "Label compression detected in question, failing.";
+            return 0;
         }
 
-        if(unlikely(pos + llen >= len)) {
-            log_pkterr("Query name truncated (runs off end of packet)");
-            pos = 0;
-            break;
+        if(unlikely(pos + llen + 1 >= len)) {
+            *err = "Query name truncated (runs off end of packet)";
+            return 0;
         }
 
-        if(unlikely(pos + llen > 254)) {
-            log_pkterr("Query domain name too long");
-            pos = 0;
-            break;
+        if(unlikely(pos + llen + 1 > 254)) {
+            *err = "Query domain name too long";
+            return 0;
         }
 
-        while(llen--) {
-            if(unlikely((buf[pos] < 0x5B) && (buf[pos] > 0x40)))
-                *lqname_ptr++ = buf[pos++] | 0x20;
-            else
-                *lqname_ptr++ = buf[pos++];
-        }
+        labels->pos[count++] = pos;
+        pos += llen + 1;
     }
+    labels->pos[count] = pos;
+    labels->count = count;
 
-    if(likely(pos)) {
-        // Store the overall length of the lowercased name
-        *lqname = pos;
+    const unsigned name_len = pos + 1;
+    *lqname = name_len;
+    lowercase_copy(&lqname[1], buf, name_len);
+
+    // Every label gets hashed exactly once per query, whichever levels of
+    //  the tree (and hence child_hash_masks) search_ltree() ends up using
+    for(unsigned i = 0; i < count; i++)
+        labels->hash[i] = label_djb_hash_full(&lqname[1 + labels->pos[i]]);
+
+    return name_len;
+}
+
+// Fills in "labels" for a name which didn't come from parse_qname()
+F_NONNULL
+static void dname_labels_get(dname_labels_t* restrict labels, const uint8_t* restrict dname) {
+    dmn_assert(labels); dmn_assert(dname);
+
+    const uint8_t* name = dname + 1;
+    unsigned pos = 0;
+    unsigned count = 0;
+    unsigned llen;
+    while((llen = name[pos])) {
+        dmn_assert(count < 127);
+        labels->pos[count] = pos;
+        labels->hash[count++] = label_djb_hash_full(&name[pos]);
+        pos += llen + 1;
+    }
+    labels->pos[count] = pos;
+    labels->count = count;
+}
+
+// "buf" points to the question section of an input packet.
+F_NONNULL
+static unsigned int parse_question(dnspacket_context_t* c, uint8_t* lqname, const uint8_t* buf, const unsigned int len) {
+    dmn_assert(c); dmn_assert(lqname); dmn_assert(buf);
 
+    const char* err = NULL;
+    unsigned pos = parse_qname(lqname, &c->qlabels, buf, len, &err);
+    if(unlikely(!pos))
+        log_pkterr("%s", err);
+
+    if(likely(pos)) {
         if(likely(pos + 4 <= len)) {
             c->qtype = ntohs(*(const uint16_t*)&buf[pos]);
             pos += 2;
@@ -220,6 +339,28 @@ static bool handle_edns_client_subnet(dnspacket_context_t* c, unsigned opt_len,
     return rv;
 }
 
+// retval: true -> FORMERR, false -> OK
+F_NONNULL
+static bool handle_edns_tcp_keepalive(dnspacket_context_t* c, unsigned opt_len) {
+    dmn_assert(c);
+
+    // RFC 7828: ignored over UDP, and clients must not send a timeout
+    if(c->is_udp)
+        return false;
+
+    if(opt_len) {
+        log_pkterr("edns_tcp_keepalive: query contains a timeout value (%u bytes)", opt_len);
+        return true;
+    }
+
+    if(!c->use_edns_tcp_keepalive) {
+        c->this_max_response -= 6; // leave room for response option
+        c->use_edns_tcp_keepalive = true;
+    }
+
+    return false;
+}
+
 // retval: true -> FORMERR, false -> OK
 F_NONNULL
 static bool handle_edns_option(dnspacket_context_t* c, unsigned opt_code, unsigned opt_len, const uint8_t* opt_data) {
@@ -228,6 +369,8 @@ static bool handle_edns_option(dnspacket_context_t* c, unsigned opt_code, unsign
     bool rv = false;
     if(opt_code == EDNS_CLIENTSUB_OPTCODE && gconfig.edns_client_subnet)
          rv = handle_edns_client_subnet(c, opt_len, opt_data);
+    else if(opt_code == EDNS_TCP_KEEPALIVE_OPTCODE)
+         rv = handle_edns_tcp_keepalive(c, opt_len);
     else
         log_debug("Unknown EDNS option code: %x", opt_code);
 
@@ -413,17 +556,106 @@ static rcode_rv_t decode_query(dnspacket_context_t* c, uint8_t* lqname, unsigned
     return rcode;
 }
 
+// Walks the labels of the name "dn" (not the len byte), storing the
+//  offset of each label to lpos[], and the hash of the suffix of the name
+//  beginning there to hashes[].  Returns the label count, not including
+//  the root.  Each hash extends the one for the suffix to its right, so
+//  this is O(len) rather than O(len * labels).
+F_NONNULL
+static unsigned comptarget_hashes(const uint8_t* dn, uint8_t* lpos, uint32_t* hashes) {
+    dmn_assert(dn); dmn_assert(lpos); dmn_assert(hashes);
+
+    unsigned labels = 0;
+    unsigned pos = 0;
+    unsigned llen;
+    while((llen = dn[pos])) {
+        dmn_assert(labels < 127);
+        lpos[labels++] = pos;
+        pos += llen + 1;
+    }
+
+    uint32_t hash = 0x811C9DC5U; // FNV-1a
+    unsigned label_end = pos;
+    for(unsigned i = labels; i--; ) {
+        for(unsigned j = lpos[i]; j < label_end; j++) {
+            hash ^= dn[j];
+            hash *= 0x01000193U;
+        }
+        hashes[i] = hash;
+        label_end = lpos[i];
+    }
+
+    return labels;
+}
+
+F_CONST
+static inline unsigned comptarget_slot(const uint32_t hash) {
+    return ((hash * 0x9E3779B1U) >> 16) & (COMPTARGETS_SLOTS - 1);
+}
+
+F_NONNULL F_PURE
+static const comptarget_t* comptarget_find(const dnspacket_context_t* c, const uint8_t* suffix, const unsigned len, const uint32_t hash) {
+    dmn_assert(c); dmn_assert(suffix);
+
+    const uint32_t gen = c->comptarget_gen;
+    unsigned slot = comptarget_slot(hash);
+    const comptarget_t* ctarg;
+    // The table is never allowed to fill, so this always terminates
+    while((ctarg = &c->comptargets[slot])->gen == gen) {
+        if(ctarg->hash == hash && ctarg->len == len && !memcmp(ctarg->suffix, suffix, len))
+            return ctarg;
+        slot = (slot + 1) & (COMPTARGETS_SLOTS - 1);
+    }
+
+    return NULL;
+}
+
+// Adds the first "count" suffixes (per lpos/hashes from comptarget_hashes())
+//  of the name "dn" (not the len byte, "dn_len" bytes long), which was just
+//  stored uncompressed at least that far at packet offset "stored_at".
+F_NONNULL
+static void comptarget_add(dnspacket_context_t* c, const uint8_t* dn, const unsigned dn_len, const uint8_t* lpos, const uint32_t* hashes, const unsigned count, const unsigned stored_at) {
+    dmn_assert(c); dmn_assert(dn); dmn_assert(lpos); dmn_assert(hashes);
+
+    const uint32_t gen = c->comptarget_gen;
+    for(unsigned i = 0; i < count; i++) {
+        const unsigned offset = stored_at + lpos[i];
+        if(unlikely(offset >= 16384 || c->comptarget_count >= COMPTARGETS_MAX))
+            break;
+        unsigned slot = comptarget_slot(hashes[i]);
+        while(c->comptargets[slot].gen == gen)
+            slot = (slot + 1) & (COMPTARGETS_SLOTS - 1);
+        comptarget_t* ctarg = &c->comptargets[slot];
+        ctarg->suffix = &dn[lpos[i]];
+        ctarg->gen = gen;
+        ctarg->hash = hashes[i];
+        ctarg->len = dn_len - lpos[i];
+        ctarg->stored_at = offset;
+        c->comptarget_count++;
+    }
+}
+
+// Adds all suffixes of the name "dn" (with the len byte), which was just
+//  stored fully uncompressed at packet offset "stored_at".
+F_NONNULL
+static void comptarget_add_name(dnspacket_context_t* c, const uint8_t* dn, const unsigned stored_at) {
+    dmn_assert(c); dmn_assert(dn);
+
+    if(*dn != 1) { // the root name is never compressed against
+        uint8_t lpos[127];
+        uint32_t hashes[127];
+        const unsigned labels = comptarget_hashes(dn + 1, lpos, hashes);
+        comptarget_add(c, dn + 1, *dn, lpos, hashes, labels, stored_at);
+    }
+}
+
 // is_addtl refers to where we're storing to
 F_NONNULL
 static unsigned int store_dname_nocomp(dnspacket_context_t* c, const unsigned int pkt_dname_offset, const uint8_t* dn) {
     dmn_assert(c); dmn_assert(pkt_dname_offset); dmn_assert(dn);
 
-    if(*dn != 1 && likely(pkt_dname_offset < 16384) && likely(c->comptarget_count < COMPTARGETS_MAX)) {
-        comptarget_t* new_ctarg = &(c->comptargets[c->comptarget_count++]);
-        new_ctarg->original = dn;
-        new_ctarg->stored_at = pkt_dname_offset;
-        new_ctarg->comp_ptr = dn + 255;
-    }
+    if(likely(pkt_dname_offset < 16384))
+        comptarget_add_name(c, dn, pkt_dname_offset);
 
     const unsigned int final_size = *dn;
     memcpy(&c->packet[pkt_dname_offset], dn + 1, final_size);
@@ -446,69 +678,32 @@ static unsigned int store_dname(dnspacket_context_t* c, const unsigned int pkt_d
     }
 
     dmn_assert(*dn > 2);
-    const uint8_t* dn_last = dn + *dn;
     const unsigned dn_len = *dn++;
 
-    unsigned int best_offset = 0;
-    const uint8_t* best_matched_at = dn + 255;
-
-    const comptarget_t* ctarg = c->comptargets;
-
-    for(unsigned x = c->comptarget_count; x--; ) {
-        const uint8_t* dn_current = dn;
-        const uint8_t* cand = ctarg->original;
-        const uint8_t* cand_comp = ctarg->comp_ptr;
-
-        dmn_assert(cand); dmn_assert(*cand > 2);
-
-        const unsigned cand_len = *cand;
-        const uint8_t* cand_last = cand++ + cand_len;
-        const uint8_t* cand_current = cand;
-
-        unsigned dn_remain = dn_last - dn;
-        unsigned cand_remain = cand_last - cand;
+    uint8_t lpos[127];
+    uint32_t hashes[127];
+    const unsigned labels = comptarget_hashes(dn, lpos, hashes);
 
-        do {
-            const int lcmp = dn_remain - cand_remain;
-            if(lcmp == 0 && !memcmp(dn_current, cand_current, dn_remain)) {
-                best_offset = ctarg->stored_at + (cand_current - cand);
-                best_matched_at = dn_current;
-                break;
-            }
-            if(lcmp >= 0) {
-                dn_current += *dn_current;
-                dn_current++;
-                if(dn_current >= best_matched_at) break;
-                if(!(dn_remain = dn_last - dn_current)) break;
-            }
-            if(lcmp <= 0) {
-                cand_current += *cand_current;
-                cand_current++;
-                if(cand_current >= cand_comp) break;
-                if(!(cand_remain = cand_last - cand_current)) break;
-            }
-        } while(1);
-        if(best_matched_at == dn) break;
-        ctarg++;
-    } // foreach candidate
+    // Find the longest suffix of this name already stored in the packet
+    const comptarget_t* ctarg = NULL;
+    unsigned matched = 0;
+    while(matched < labels) {
+        ctarg = comptarget_find(c, &dn[lpos[matched]], dn_len - lpos[matched], hashes[matched]);
+        if(ctarg)
+            break;
+        matched++;
+    }
 
     // If we didn't fully compress (either partially, or not at all)
-    //  store this as a compression target for future use.
-    if(best_matched_at != dn) {
-        if(!is_addtl && likely(pkt_dname_offset < 16384) && likely(c->comptarget_count < COMPTARGETS_MAX)) {
-            comptarget_t* new_ctarg = &(c->comptargets[c->comptarget_count++]);
-            new_ctarg->original = dn - 1;
-            new_ctarg->stored_at = pkt_dname_offset;
-            new_ctarg->comp_ptr = best_matched_at;
-        }
-    }
+    //  store the uncompressed suffixes as compression targets for future use.
+    if(matched && !is_addtl)
+        comptarget_add(c, dn, dn_len, lpos, hashes, matched, pkt_dname_offset);
 
-    if(best_offset) {
-        const unsigned int final_size = best_matched_at - dn + 2;
-        const unsigned int tocopy = final_size - 2;
+    if(ctarg) {
+        const unsigned int tocopy = lpos[matched];
         memcpy(&packet[pkt_dname_offset], dn, tocopy);
-        *((uint16_t*)&packet[pkt_dname_offset + tocopy]) = htons(0xC000 | best_offset);
-        return final_size;
+        *((uint16_t*)&packet[pkt_dname_offset + tocopy]) = htons(0xC000 | ctarg->stored_at);
+        return tocopy + 2;
     }
     else {
         memcpy(&packet[pkt_dname_offset], dn, dn_len);
@@ -573,6 +768,47 @@ static unsigned int repeat_name(dnspacket_context_t* c, unsigned int store_at_of
     return rv;
 }
 
+// Upper bound on the number of distinct rotations pre-encoded for one
+//  response (preencode_answers); responses which would need more are
+//  left to be encoded at runtime
+#define PREENCODE_MAX_ROT 12
+
+// Used by OFFSET_LOOP_START below while pre-encoding, in place of a random
+//  index.  An rrset of "total" records repeats every "total" rotations, so
+//  the response as a whole repeats every lcm() of those.
+F_NONNULL
+static unsigned render_rotation(dnspacket_context_t* c, const unsigned total) {
+    dmn_assert(c); dmn_assert(c->rendering); dmn_assert(total);
+
+    unsigned a = c->render_period;
+    unsigned b = total;
+    while(b) {
+        const unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    const unsigned period = c->render_period / a * total;
+    if(period > PREENCODE_MAX_ROT)
+        c->render_failed = true;
+    else
+        c->render_period = period;
+
+    return c->render_rot;
+}
+
+// Used by OFFSET_LOOP_START below at runtime
+F_NONNULL
+static unsigned random_rotation(dnspacket_context_t* c, const unsigned total) {
+    dmn_assert(c); dmn_assert(total);
+
+    if(total == 1)
+        return 0;
+    c->answer_rotated = true;
+    if(c->rot_fixed)
+        return c->rot_base;
+    return gdnsd_rand_get32(c->rand_state);
+}
+
 // These macros define a common pattern around the body of a loop encoding
 //  an rrset.  They behave like a for-loop specified as...
 //    for(unsigned i = 0; i < _limit; i++) { ... }
@@ -585,7 +821,9 @@ static unsigned int repeat_name(dnspacket_context_t* c, unsigned int store_at_of
         const unsigned _tot = (_total);\
         if(_tot) {\
             unsigned _x_count = (_limit);\
-            unsigned i = gdnsd_rand_get32(c->rand_state) % _tot;\
+            unsigned i = (unlikely(c->rendering)\
+                ? render_rotation(c, _tot)\
+                : random_rotation(c, _tot)) % _tot;\
             while(_x_count--) {\
 
 // Your code using "i" as an rrset index goes here
@@ -716,9 +954,29 @@ static void do_dynaddr_callback(dnspacket_context_t* c, const ltree_rrset_addr_t
     dmn_assert(c); dmn_assert(rrset); dmn_assert(!rrset->gen.c.is_static);
 
     dynaddr_result_t* dr = c->dynaddr;
-    memset(dr, 0, sizeof(dynaddr_result_t));
-    dr->ttl = ntohl(rrset->gen.ttl);
-    rrset->a.dyn.func(c->threadnum, rrset->a.dyn.resource, &c->client_info, dr);
+
+    // Dynamic results can't be pre-encoded, and plugins aren't
+    //  ready to be called during zone loading anyways
+    if(unlikely(c->rendering)) {
+        memset(dr, 0, sizeof(dynaddr_result_t));
+        c->render_failed = true;
+        return;
+    }
+
+    c->answer_dynamic = true;
+    const bool cacheable = c->dyncache && rrset->a.dyn.cacheable;
+    if(cacheable && dyncache_get_addr(c->dyncache, rrset, &c->client_info, dr)) {
+        satom_inc(&c->stats->dyncache_hit);
+    }
+    else {
+        memset(dr, 0, sizeof(dynaddr_result_t));
+        dr->ttl = ntohl(rrset->gen.ttl);
+        rrset->a.dyn.func(c->threadnum, rrset->a.dyn.resource, &c->client_info, dr);
+        if(cacheable) {
+            satom_inc(&c->stats->dyncache_miss);
+            dyncache_put_addr(c->dyncache, rrset, &c->client_info, dr);
+        }
+    }
     if(dr->edns_scope_mask > c->edns_client_scope_mask)
         c->edns_client_scope_mask = dr->edns_scope_mask;
 }
@@ -1041,9 +1299,20 @@ static unsigned int encode_rr_cname(dnspacket_context_t* c, unsigned int offset,
     }
     else {
         dyncname_result_t ans_dync = {0,0,{0}};
-        ans_dync.ttl = ntohl(rd->gen.ttl);
 
-        rd->c.dyn.func(c->threadnum, rd->c.dyn.resource, rd->c.dyn.origin, &c->client_info, &ans_dync);
+        c->answer_dynamic = true;
+        const bool cacheable = c->dyncache && rd->c.dyn.cacheable;
+        if(cacheable && dyncache_get_cname(c->dyncache, rd, &c->client_info, &ans_dync)) {
+            satom_inc(&c->stats->dyncache_hit);
+        }
+        else {
+            ans_dync.ttl = ntohl(rd->gen.ttl);
+            rd->c.dyn.func(c->threadnum, rd->c.dyn.resource, rd->c.dyn.origin, &c->client_info, &ans_dync);
+            if(cacheable) {
+                satom_inc(&c->stats->dyncache_miss);
+                dyncache_put_cname(c->dyncache, rd, &c->client_info, &ans_dync);
+            }
+        }
         if(ans_dync.edns_scope_mask > c->edns_client_scope_mask)
             c->edns_client_scope_mask = ans_dync.edns_scope_mask;
         ttl = htonl(ans_dync.ttl);
@@ -1493,26 +1762,17 @@ static unsigned int construct_normal_response(dnspacket_context_t* c, unsigned i
     return offset;
 }
 
-F_NONNULLX(1, 2, 3)
-static ltree_dname_status_t search_ltree(const uint8_t* restrict dname, const ltree_node_t** restrict node_out, const ltree_node_t** restrict auth_out, const ltree_node_t* checkroot, unsigned* auth_depth_out, bool* checkroot_crossed) {
-    dmn_assert(dname); dmn_assert(node_out); dmn_assert(auth_out); dmn_assert(*dname != 0); dmn_assert(*dname != 2);
+// "labels" describes "dname", from parse_qname() or dname_labels_get()
+F_NONNULLX(1, 2, 3, 4)
+static ltree_dname_status_t search_ltree(const uint8_t* restrict dname, const dname_labels_t* restrict labels, const ltree_node_t** restrict node_out, const ltree_node_t** restrict auth_out, const ltree_node_t* checkroot, unsigned* auth_depth_out, bool* checkroot_crossed) {
+    dmn_assert(dname); dmn_assert(labels); dmn_assert(node_out); dmn_assert(auth_out); dmn_assert(*dname != 0); dmn_assert(*dname != 2);
+    dmn_assert(labels->pos[labels->count] + 1U == *dname);
 
     dmn_assert( (checkroot && checkroot_crossed && !*checkroot_crossed)
          || (!checkroot && !checkroot_crossed) );
 
-    // construct label ptr stack
-    const uint8_t* lptr_stack[127];
-    unsigned label_idx = 0;
-
-    {
-        uint8_t llen;
-        ++dname;
-        while((llen = *dname)) {
-            dmn_assert(label_idx < 127);
-            lptr_stack[label_idx++] = dname++;
-            dname += llen;
-        }
-    }
+    const uint8_t* name = dname + 1;
+    unsigned label_idx = labels->count;
 
     ltree_dname_status_t rval = DNAME_NOAUTH;
     *auth_out = NULL;
@@ -1526,14 +1786,8 @@ static ltree_dname_status_t search_ltree(const uint8_t* restrict dname, const lt
         if(checkroot && current == checkroot)
             *checkroot_crossed = true;
         if(current->flags & (LTNFLAG_ZROOT | LTNFLAG_DELEG)) {
-            unsigned auth_depth = label_idx;
-            unsigned i = label_idx;
-            while(i) {
-                i--;
-                auth_depth += lptr_stack[i][0];
-            }
-
-            *auth_depth_out = auth_depth;
+            // the unmatched labels precede this node's name
+            *auth_depth_out = labels->pos[label_idx];
             if(current->flags & LTNFLAG_ZROOT) {
                 *auth_out = current;
                 *node_out = NULL;
@@ -1551,8 +1805,8 @@ static ltree_dname_status_t search_ltree(const uint8_t* restrict dname, const lt
         }
 
         label_idx--;
-        const uint8_t* child_label = lptr_stack[label_idx];
-        const ltree_node_t* entry = current->child_table[label_djb_hash(child_label, current->child_hash_mask)];
+        const uint8_t* child_label = &name[labels->pos[label_idx]];
+        const ltree_node_t* entry = current->child_table[labels->hash[label_idx] & current->child_hash_mask];
 
         while(entry) {
             if(!memcmp(entry->label, child_label, *child_label + 1)) {
@@ -1611,6 +1865,68 @@ static unsigned chase_auth_ptr(const uint8_t* packet, unsigned offset, unsigned
     return offset;
 }
 
+// A pre-encoded static response (preencode_answers), built by
+//  dnspacket_preencode_node() by running construct_normal_response() on
+//  the node's own name.  Compression pointers in the data are absolute
+//  packet offsets, which is why these are only used when the query name
+//  is an exact (non-wildcard) match for the node, in the question section.
+//  Responses with rotated rrsets have one rendering per rotation.
+typedef struct {
+    const addtl_rrset_t* addtl_rrsets; // for trimming the additional section
+    const uint8_t* main;               // answer and authority sections
+    const uint8_t* addtl;              // additional section (c->addtl_store)
+    unsigned main_len;
+    unsigned addtl_len;
+    unsigned addtl_count;
+    unsigned ancount;
+    unsigned nscount;
+    unsigned arcount;
+    bool addtl_has_glue;
+} tmpl_rot_t;
+
+struct _ltree_tmpl_struct {
+    ltree_tmpl_t* next;
+    unsigned qtype;
+    unsigned rot_count;
+    tmpl_rot_t rots[];
+};
+
+F_NONNULL F_PURE
+static const ltree_tmpl_t* find_tmpl(const ltree_node_t* node, const unsigned qtype) {
+    dmn_assert(node);
+
+    const ltree_tmpl_t* tmpl = node->tmpls;
+    while(tmpl && tmpl->qtype != qtype)
+        tmpl = tmpl->next;
+    return tmpl;
+}
+
+// Leaves the context in the same state as construct_normal_response()
+//  would have, for answer_from_db_outer()
+F_NONNULL
+static unsigned int encode_from_tmpl(dnspacket_context_t* c, unsigned int offset, const ltree_tmpl_t* tmpl) {
+    dmn_assert(c); dmn_assert(c->packet); dmn_assert(offset); dmn_assert(tmpl);
+
+    unsigned rot = 0;
+    if(tmpl->rot_count > 1) {
+        c->answer_rotated = true;
+        rot = (c->rot_fixed ? c->rot_base : gdnsd_rand_get32(c->rand_state)) % tmpl->rot_count;
+    }
+    const tmpl_rot_t* r = &tmpl->rots[rot];
+
+    memcpy(&c->packet[offset], r->main, r->main_len);
+    memcpy(c->addtl_store, r->addtl, r->addtl_len);
+    memcpy(c->addtl_rrsets, r->addtl_rrsets, r->addtl_count * sizeof(addtl_rrset_t));
+    c->addtl_offset = r->addtl_len;
+    c->addtl_count = r->addtl_count;
+    c->addtl_has_glue = r->addtl_has_glue;
+    c->ancount = r->ancount;
+    c->nscount = r->nscount;
+    c->arcount = r->arcount;
+
+    return offset + r->main_len;
+}
+
 F_NONNULL
 static unsigned int answer_from_db(dnspacket_context_t* c, const uint8_t* qname, unsigned int offset) {
     dmn_assert(c); dmn_assert(qname); dmn_assert(offset);
@@ -1625,7 +1941,7 @@ static unsigned int answer_from_db(dnspacket_context_t* c, const uint8_t* qname,
     // In the initial search, it's known that "qname" is in fact the real query name and therefore
     //  uncompressed, which is what makes the simplistic c->auth_comp calculation possible.
     unsigned auth_depth;
-    ltree_dname_status_t status = search_ltree(qname, &resdom, &resauth, NULL, &auth_depth, NULL);
+    ltree_dname_status_t status = search_ltree(qname, &c->qlabels, &resdom, &resauth, NULL, &auth_depth, NULL);
     c->auth_comp = c->qname_comp + auth_depth;
 
     // CNAME handling, which fills in 1+ CNAME RRs and then alters status/resdom/via_cname
@@ -1654,7 +1970,9 @@ static unsigned int answer_from_db(dnspacket_context_t* c, const uint8_t* qname,
                         
         bool resauth_crossed = false;
         const uint8_t* dname = cname->gen.c.is_static ? cname->c.dname : &c->dync_store[(c->dync_count - 1) * 256];
-        status = search_ltree(dname, &resdom, &resauth, resauth, &auth_depth, &resauth_crossed);
+        dname_labels_t labels;
+        dname_labels_get(&labels, dname);
+        status = search_ltree(dname, &labels, &resdom, &resauth, resauth, &auth_depth, &resauth_crossed);
         // encode_rr_cname() above updated c->qname_comp, and now we need to update c->auth_comp
         //  to match based on search_ltree's auth_depth output, assuming auth or deleg response
         if(!resauth_crossed) {
@@ -1670,7 +1988,13 @@ static unsigned int answer_from_db(dnspacket_context_t* c, const uint8_t* qname,
         dmn_assert(resauth);
         res_hdr->flags1 |= 4; // AA bit
         if(likely(resdom)) {
-            offset = construct_normal_response(c, offset, resdom, resauth);
+            // Pre-encoded responses assume the query name is uncompressed
+            //  in the question, which isn't the case at the end of a CNAME chain
+            const ltree_tmpl_t* tmpl = via_cname ? NULL : find_tmpl(resdom, c->qtype);
+            if(tmpl)
+                offset = encode_from_tmpl(c, offset, tmpl);
+            else
+                offset = construct_normal_response(c, offset, resdom, resauth);
         }
         else {
             const ltree_rrset_soa_t* soa = ltree_node_get_rrset_soa(resauth);
@@ -1735,6 +2059,301 @@ static unsigned int answer_from_db_outer(dnspacket_context_t* c, uint8_t* qname,
     return offset;
 }
 
+F_NONNULL F_PURE
+static uint32_t rcache_hash(const uint8_t* lqname, const unsigned qtype, const unsigned max_response) {
+    dmn_assert(lqname);
+
+    uint32_t hash = 0x811C9DC5U; // FNV-1a
+    const unsigned len = *lqname + 1U;
+    for(unsigned i = 0; i < len; i++) {
+        hash ^= lqname[i];
+        hash *= 0x01000193U;
+    }
+    hash ^= (qtype << 16) ^ max_response;
+    hash *= 0x01000193U;
+    return hash;
+}
+
+F_NONNULL F_PURE
+static rcache_entry_t* rcache_slot(const dnspacket_context_t* c, const uint32_t hash, const unsigned variant) {
+    dmn_assert(c); dmn_assert(c->rcache);
+    return &c->rcache[((hash >> 7) ^ hash ^ (variant * 0x9E3779B1U)) & c->rcache_mask];
+}
+
+F_NONNULL F_PURE
+static bool rcache_match(const rcache_entry_t* e, const uint32_t hash, const uint8_t* lqname, const unsigned qtype, const unsigned max_response, const unsigned variant) {
+    dmn_assert(e); dmn_assert(lqname);
+    return e->used
+        && e->hash == hash
+        && e->qtype == qtype
+        && e->max_response == max_response
+        && e->variant == variant
+        && !memcmp(e->lqname, lqname, *lqname + 1U);
+}
+
+// Wraps answer_from_db_outer() with the per-thread response cache
+//  (response_cache_size).  Static answers don't depend on anything but
+//  the query name and type and the response size limit, so the bytes
+//  and state answer_from_db_outer() would produce can be replayed from
+//  an earlier identical query.  Rotated answers are cached in up to
+//  RCACHE_VARIANTS variants (successive rotations from a random start),
+//  and a hit picks one of them at random.
+F_NONNULL
+static unsigned int answer_from_rcache(dnspacket_context_t* c, uint8_t* lqname, unsigned int offset) {
+    dmn_assert(c); dmn_assert(c->rcache); dmn_assert(lqname); dmn_assert(offset);
+
+    const unsigned qtype = c->qtype;
+    const unsigned max_response = c->this_max_response;
+    const uint32_t hash = rcache_hash(lqname, qtype, max_response);
+
+    unsigned variant = 0;
+    uint32_t rot_base;
+    rcache_entry_t* e = rcache_slot(c, hash, 0);
+    bool hit = rcache_match(e, hash, lqname, qtype, max_response, 0);
+    if(!hit) {
+        rot_base = gdnsd_rand_get32(c->rand_state);
+    }
+    else if(e->rotated) {
+        variant = gdnsd_rand_get32(c->rand_state) % RCACHE_VARIANTS;
+        if(variant) {
+            rot_base = e->rot_base + variant;
+            e = rcache_slot(c, hash, variant);
+            hit = rcache_match(e, hash, lqname, qtype, max_response, variant);
+        }
+    }
+
+    wire_dns_header_t* res_hdr = (wire_dns_header_t*)c->packet;
+
+    if(hit) {
+        satom_inc(&c->stats->rcache_hit);
+        memcpy(&c->packet[offset], e->data, e->len);
+        res_hdr->flags1 |= e->flags1;
+        res_hdr->flags2 = e->flags2;
+        c->ancount = e->ancount;
+        c->cname_ancount = e->cname_ancount;
+        c->nscount = e->nscount;
+        c->arcount = e->arcount;
+
+        // The same stats answer_from_db*() would have counted
+        if(e->flags2 == DNS_RCODE_NXDOMAIN)
+            satom_inc(&c->stats->nxdomain);
+        else if(e->flags2 == DNS_RCODE_REFUSED)
+            satom_inc(&c->stats->refused);
+        if(e->flags1 & 0x2) {
+            if(c->use_edns)
+                satom_inc(&c->stats->p.udp.edns_tc);
+            else
+                satom_inc(&c->stats->p.udp.tc);
+        }
+
+        return offset + e->len;
+    }
+
+    satom_inc(&c->stats->rcache_miss);
+    c->rot_fixed = true;
+    c->rot_base = rot_base;
+    const unsigned start = offset;
+    offset = answer_from_db_outer(c, lqname, offset);
+
+    const unsigned len = offset - start;
+    if(!c->answer_dynamic && len <= RCACHE_DATA) {
+        e->hash = hash;
+        e->qtype = qtype;
+        e->max_response = max_response;
+        e->rot_base = rot_base;
+        e->len = len;
+        e->ancount = c->ancount;
+        e->cname_ancount = c->cname_ancount;
+        e->nscount = c->nscount;
+        e->arcount = c->arcount;
+        e->variant = variant;
+        e->flags1 = res_hdr->flags1 & 0x6;
+        e->flags2 = res_hdr->flags2;
+        e->used = true;
+        e->rotated = c->answer_rotated;
+        memcpy(e->lqname, lqname, *lqname + 1U);
+        memcpy(e->data, &c->packet[start], len);
+    }
+
+    return offset;
+}
+
+// The batch prefetcher below walks the ltree for up to this many
+//  queries at a time, interleaved with each other
+#define PREFETCH_BATCH 16
+
+typedef enum {
+    PF_DONE = 0, // no (further) prefetching for this query
+    PF_DESCEND,  // current node matched, next prefetch its child_table slot
+    PF_SLOT,     // child_table slot prefetched, next read the entry pointer
+    PF_ENTRY,    // hash chain entry prefetched, next prefetch its label
+    PF_LABEL,    // entry's label prefetched, next compare it
+} pf_state_t;
+
+typedef struct {
+    const ltree_node_t* current; // deepest matched node so far
+    const ltree_node_t* entry;   // hash chain entry under consideration
+    const ltree_node_t* const* slot;
+    pf_state_t state;
+    unsigned label_idx;          // labels of qname not yet matched
+    const uint8_t* qname;        // question name within the raw packet
+    uint8_t pos[128];            // offsets of qname's labels
+    uint8_t label[64];           // lowercased copy of the label at label_idx
+} pf_query_t;
+
+// Finds the label offsets of the question name in a raw query, which is
+//  all the prefetcher needs up front: only the labels it actually walks
+//  get lowercased and hashed (in pf_step()), and decode_query() does the
+//  full parse.  Anything unusual simply isn't prefetched, and is left for
+//  decode_query() to deal with properly.
+F_NONNULL
+static bool pf_parse_qname(pf_query_t* pfq, const uint8_t* packet, const unsigned packet_len) {
+    dmn_assert(pfq); dmn_assert(packet);
+
+    if(packet_len <= sizeof(wire_dns_header_t))
+        return false;
+
+    const uint8_t* qname = &packet[sizeof(wire_dns_header_t)];
+    const unsigned len = packet_len - sizeof(wire_dns_header_t);
+    unsigned pos = 0;
+    unsigned count = 0;
+    unsigned llen;
+    while((llen = qname[pos])) {
+        if((llen & 0xC0) || pos + llen + 1 >= len || pos + llen + 1 > 254)
+            return false;
+        pfq->pos[count++] = pos;
+        pos += llen + 1;
+    }
+
+    pfq->qname = qname;
+    pfq->label_idx = count;
+    return true;
+}
+
+// Advances one query's ltree walk by one step: the step either issues a
+//  prefetch for the next dependent load and returns, or finds that there's
+//  nothing more to prefetch.  This follows the same path as search_ltree()
+//  through exact label matches only, which covers nearly everything it
+//  will touch.
+F_NONNULL
+static void pf_step(pf_query_t* pfq) {
+    dmn_assert(pfq);
+
+    switch(pfq->state) {
+        case PF_SLOT:
+            pfq->entry = *pfq->slot;
+            if(!pfq->entry) {
+                pfq->state = PF_DONE;
+                break;
+            }
+            PREFETCH(pfq->entry);
+            pfq->state = PF_ENTRY;
+            break;
+        case PF_ENTRY:
+            PREFETCH(pfq->entry->label);
+            pfq->state = PF_LABEL;
+            break;
+        case PF_LABEL: {
+            const uint8_t* child_label = pfq->label;
+            const ltree_node_t* entry = pfq->entry;
+            if(memcmp(entry->label, child_label, *child_label + 1)) {
+                pfq->entry = entry->next;
+                if(pfq->entry) {
+                    PREFETCH(pfq->entry);
+                    pfq->state = PF_ENTRY;
+                }
+                else {
+                    pfq->state = PF_DONE;
+                }
+                break;
+            }
+            // matched: descend (the node itself is already cached)
+            pfq->current = entry;
+            PREFETCH(entry->rrsets);
+        }
+        // fall through
+        case PF_DESCEND: {
+            const ltree_node_t* current = pfq->current;
+            if(!pfq->label_idx || !current->child_table) {
+                pfq->state = PF_DONE;
+                break;
+            }
+            pfq->label_idx--;
+            const uint8_t* raw_label = &pfq->qname[pfq->pos[pfq->label_idx]];
+            lowercase_copy(pfq->label, raw_label, *raw_label + 1);
+            pfq->slot = (const ltree_node_t* const*)&current->child_table[label_djb_hash(pfq->label, current->child_hash_mask)];
+            PREFETCH(pfq->slot);
+            pfq->state = PF_SLOT;
+            break;
+        }
+        default:
+            dmn_assert(0);
+    }
+}
+
+F_NONNULL
+static void prefetch_batch(const unsigned count, uint8_t* const* packets, const unsigned* lens) {
+    dmn_assert(packets); dmn_assert(lens);
+    dmn_assert(count <= PREFETCH_BATCH);
+
+    pf_query_t pfqs[PREFETCH_BATCH];
+    unsigned active = 0;
+
+    for(unsigned i = 0; i < count; i++) {
+        pf_query_t* pfq = &pfqs[active];
+        if(pf_parse_qname(pfq, packets[i], lens[i])) {
+            pfq->current = ltree_root;
+            pfq->state = PF_DESCEND;
+            pf_step(pfq); // kick off the root's child_table slot
+            if(pfq->state != PF_DONE)
+                active++;
+        }
+    }
+
+    // Round-robin over the in-flight walks, so that each prefetch has the
+    //  other queries' steps to complete behind before its data is used.
+    while(active) {
+        unsigned i = 0;
+        while(i < active) {
+            pf_step(&pfqs[i]);
+            if(pfqs[i].state != PF_DONE)
+                i++;
+            else if(i != --active)
+                memcpy(&pfqs[i], &pfqs[active], sizeof(pf_query_t));
+        }
+    }
+}
+
+void process_dns_query_batch(dnspacket_context_t* c, const unsigned count, const anysin_t* asins, uint8_t* const* packets, unsigned* lens) {
+    dmn_assert(c); dmn_assert(asins); dmn_assert(packets); dmn_assert(lens);
+
+    for(unsigned base = 0; base < count; base += PREFETCH_BATCH) {
+        const unsigned chunk = (count - base) < PREFETCH_BATCH ? (count - base) : PREFETCH_BATCH;
+        prefetch_batch(chunk, &packets[base], &lens[base]);
+        for(unsigned i = base; i < base + chunk; i++)
+            if(likely(lens[i]))
+                lens[i] = process_dns_query(c, &asins[i], packets[i], lens[i]);
+    }
+}
+
+F_NONNULL F_PURE
+static rrl_class_t rrl_classify(const dnspacket_context_t* c, const rcode_rv_t status) {
+    dmn_assert(c);
+    const wire_dns_header_t* hdr = (const wire_dns_header_t*)c->packet;
+
+    if(status != DECODE_OK)
+        return RRL_CLASS_ERROR;
+    if(hdr->flags2 == DNS_RCODE_NXDOMAIN)
+        return RRL_CLASS_NXDOMAIN;
+    if(hdr->flags2 != DNS_RCODE_NOERROR)
+        return RRL_CLASS_ERROR;
+    if(c->ancount || c->cname_ancount)
+        return RRL_CLASS_ANSWER;
+    if(c->nscount && !(hdr->flags1 & 4)) // no AA bit
+        return RRL_CLASS_REFERRAL;
+    return RRL_CLASS_NODATA;
+}
+
 unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uint8_t* packet, const unsigned int packet_len) {
     dmn_assert(c && asin && packet);
 
@@ -1782,17 +2401,15 @@ unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uin
 
     if(likely(status == DECODE_OK)) {
         hdr->flags2 = DNS_RCODE_NOERROR;
-        if(*lqname != 1) {
-            c->comptarget_count = 1;
-            c->comptargets[0].original = lqname;
-            c->comptargets[0].comp_ptr = lqname + 255;
-            c->comptargets[0].stored_at = sizeof(wire_dns_header_t);
-        }
+        comptarget_add_name(c, lqname, sizeof(wire_dns_header_t));
         c->qname_comp = 0x0C;
 
         if(likely(!c->chaos)) {
             memcpy(&c->client_info.dns_source, asin, sizeof(anysin_t));
-            res_offset = answer_from_db_outer(c, lqname, res_offset);
+            if(c->rcache)
+                res_offset = answer_from_rcache(c, lqname, res_offset);
+            else
+                res_offset = answer_from_db_outer(c, lqname, res_offset);
         }
         else {
             c->ancount = 1;
@@ -1814,6 +2431,26 @@ unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uin
         }
     }
 
+    if(c->rrl) {
+        const rrl_action_t rrl_act = rrl_check(c->rrl, asin, rrl_classify(c, status), lqname, c->qtype);
+        if(unlikely(rrl_act != RRL_SEND)) {
+            if(rrl_act == RRL_DROP) {
+                satom_inc(&c->stats->p.udp.rrl_drop);
+                return 0;
+            }
+            // Slip: an empty truncated response, so that real clients
+            //  behind a spoofed source can still get through via TCP
+            dmn_assert(rrl_act == RRL_SLIP);
+            res_offset = sizeof(wire_dns_header_t) + question_len;
+            c->ancount = 0;
+            c->cname_ancount = 0;
+            c->nscount = 0;
+            c->arcount = 0;
+            hdr->flags1 |= 0x2; // TC bit
+            satom_inc(&c->stats->p.udp.rrl_slip);
+        }
+    }
+
     if(c->use_edns) {
         packet[res_offset++] = '\0'; // domainname part of OPT
         wire_dns_rr_opt_t* opt = (wire_dns_rr_opt_t*)&packet[res_offset];
@@ -1822,14 +2459,13 @@ unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uin
         opt->type = htons(DNS_TYPE_OPT);
         opt->maxsize = htons(DNS_EDNS0_SIZE);
         opt->extflags = (status == DECODE_BADVERS) ? htonl(0x01000000) : 0;
-        opt->rdlen = 0;
+        const unsigned rdata_offset = res_offset;
 
         if(c->use_edns_client_subnet) {
             *(uint16_t*)&packet[res_offset] = htons(EDNS_CLIENTSUB_OPTCODE);
             res_offset += 2;
             const unsigned src_mask = c->client_info.edns_client_mask;
             const unsigned addr_bytes = (src_mask >> 3) + ((src_mask & 7) ? 1 : 0);
-            opt->rdlen = htons(8 + addr_bytes);
             *(uint16_t*)&packet[res_offset] = htons(4 + addr_bytes); // optlen
             res_offset += 2;
             if(c->client_info.edns_client.sa.sa_family == AF_INET) {
@@ -1851,6 +2487,17 @@ unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uin
             }
         }
 
+        if(c->use_edns_tcp_keepalive) {
+            dmn_assert(!c->is_udp);
+            *(uint16_t*)&packet[res_offset] = htons(EDNS_TCP_KEEPALIVE_OPTCODE);
+            res_offset += 2;
+            *(uint16_t*)&packet[res_offset] = htons(2); // optlen
+            res_offset += 2;
+            *(uint16_t*)&packet[res_offset] = htons(c->edns_tcp_keepalive);
+            res_offset += 2;
+        }
+
+        opt->rdlen = htons(res_offset - rdata_offset);
         c->arcount++;
         if(likely(c->is_udp)) {
             // We only do one kind of truncation: complete truncation.
@@ -1865,3 +2512,136 @@ unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uin
 
     return res_offset;
 }
+
+// Context for dnspacket_preencode_node(), only used from the main thread
+//  at zone loading time
+static dnspacket_context_t* render_ctx = NULL;
+
+static dnspacket_context_t* render_context_get(void) {
+    if(!render_ctx) {
+        dnspacket_context_t* c = render_ctx = calloc(1, sizeof(dnspacket_context_t));
+        c->rendering = true;
+        c->rand_state = gdnsd_rand_init();
+        c->addtl_rrsets = malloc(gconfig.max_addtl_rrsets * sizeof(addtl_rrset_t));
+        c->comptargets = calloc(COMPTARGETS_SLOTS, sizeof(comptarget_t));
+        c->dync_store = malloc(gconfig.max_cname_depth * 256);
+        c->addtl_store = malloc(gconfig.max_response);
+        c->dynaddr = malloc(sizeof(dynaddr_result_t));
+        c->packet = malloc(gconfig.max_response);
+    }
+    return render_ctx;
+}
+
+F_NONNULL
+static void tmpl_free(ltree_tmpl_t* tmpl, const unsigned rendered) {
+    dmn_assert(tmpl);
+    for(unsigned i = 0; i < rendered; i++)
+        free((void*)tmpl->rots[i].addtl_rrsets);
+    free(tmpl);
+}
+
+// Renders every rotation of the response to "qtype" at "node" (whose
+//  full name is "dname", in zone "authdom"), or returns NULL if it can't be
+//  pre-encoded.  This sets up the context just as process_dns_query() and
+//  answer_from_db() would for a query of this exact name.
+F_NONNULL
+static ltree_tmpl_t* render_tmpl(dnspacket_context_t* c, const ltree_node_t* node, const ltree_node_t* authdom, const uint8_t* dname, const unsigned auth_depth, const unsigned qtype) {
+    dmn_assert(c); dmn_assert(c->rendering);
+    dmn_assert(node); dmn_assert(authdom); dmn_assert(dname);
+
+    uint8_t* packet = c->packet;
+    const unsigned qname_len = *dname;
+    const unsigned start = sizeof(wire_dns_header_t) + qname_len + 4;
+
+    ltree_tmpl_t* tmpl = NULL;
+    unsigned rot = 0;
+    do {
+        reset_context(c);
+        c->render_failed = false;
+        c->render_rot = rot;
+        c->render_period = 1;
+        c->qtype = qtype;
+        c->this_max_response = gconfig.max_response;
+
+        memset(packet, 0, sizeof(wire_dns_header_t));
+        memcpy(&packet[sizeof(wire_dns_header_t)], dname + 1, qname_len);
+        *((uint16_t*)&packet[start - 4]) = htons(qtype);
+        *((uint16_t*)&packet[start - 2]) = htons(DNS_CLASS_IN);
+        comptarget_add_name(c, dname, sizeof(wire_dns_header_t));
+        c->qname_comp = 0x0C;
+        c->auth_comp = c->qname_comp + auth_depth;
+
+        const unsigned end = construct_normal_response(c, start, node, authdom);
+        dmn_assert(end <= gconfig.max_response);
+
+        if(c->render_failed || (tmpl && c->render_period != tmpl->rot_count)) {
+            if(tmpl)
+                tmpl_free(tmpl, rot);
+            return NULL;
+        }
+
+        if(!tmpl) {
+            tmpl = calloc(1, sizeof(ltree_tmpl_t) + (c->render_period * sizeof(tmpl_rot_t)));
+            tmpl->qtype = qtype;
+            tmpl->rot_count = c->render_period;
+        }
+
+        // One allocation per rotation: the unwind info, then the sections
+        tmpl_rot_t* r = &tmpl->rots[rot];
+        const unsigned unwind_size = c->addtl_count * sizeof(addtl_rrset_t);
+        r->main_len = end - start;
+        r->addtl_len = c->addtl_offset;
+        r->addtl_count = c->addtl_count;
+        r->ancount = c->ancount;
+        r->nscount = c->nscount;
+        r->arcount = c->arcount;
+        r->addtl_has_glue = c->addtl_has_glue;
+        uint8_t* data = malloc(unwind_size + r->main_len + r->addtl_len);
+        memcpy(data, c->addtl_rrsets, unwind_size);
+        memcpy(&data[unwind_size], &packet[start], r->main_len);
+        memcpy(&data[unwind_size + r->main_len], c->addtl_store, r->addtl_len);
+        r->addtl_rrsets = (const addtl_rrset_t*)data;
+        r->main = &data[unwind_size];
+        r->addtl = &data[unwind_size + r->main_len];
+    } while(++rot < tmpl->rot_count);
+
+    return tmpl;
+}
+
+unsigned dnspacket_preencode_node(ltree_node_t* node, const uint8_t* dname) {
+    dmn_assert(node); dmn_assert(dname);
+
+    // Only names which answer for themselves, as opposed to
+    //  delegations and wildcards (which also answer for names of
+    //  other lengths than their own)
+    if(node->label[0] == 1 && node->label[1] == '*')
+        return 0;
+
+    const ltree_node_t* resdom;
+    const ltree_node_t* resauth;
+    unsigned auth_depth;
+    dname_labels_t labels;
+    dname_labels_get(&labels, dname);
+    if(search_ltree(dname, &labels, &resdom, &resauth, NULL, &auth_depth, NULL) != DNAME_AUTH || resdom != node)
+        return 0;
+
+    dnspacket_context_t* c = render_context_get();
+    unsigned count = 0;
+
+    for(const ltree_rrset_t* rrset = node->rrsets; rrset; rrset = rrset->gen.next) {
+        if(!rrset->gen.c.is_static)
+            continue;
+        // rrset_addr is stored as type DNS_TYPE_A for both A and AAAA
+        const unsigned qtypes[2] = { rrset->gen.type, rrset->gen.type == DNS_TYPE_A ? DNS_TYPE_AAAA : 0 };
+        for(unsigned i = 0; i < 2 && qtypes[i]; i++) {
+            ltree_tmpl_t* tmpl = render_tmpl(c, node, resauth, dname, auth_depth, qtypes[i]);
+            if(tmpl) {
+                tmpl->next = node->tmpls;
+                node->tmpls = tmpl;
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
@@ -24,8 +24,23 @@
 #include "gdnsd.h"
 #include "ltree.h"
 #include "gdnsd-misc.h"
+#include "rrl.h"
+#include "dyncache.h"
 
-#define COMPTARGETS_MAX 256
+// Size of the per-context hash table of compression targets (a power of
+//  two), and the most entries it's allowed to hold before new ones are
+//  simply not added (so that probe sequences stay short)
+#define COMPTARGETS_SLOTS 1024
+#define COMPTARGETS_MAX 768
+
+// UDP recvmmsg() batch-fill histogram buckets, by powers of two:
+//  1, 2-3, 4-7, 8-15, 16-31, 32-63, 64
+#define UDP_BATCH_BUCKETS 7
+
+// UDP kernel-receive-to-reply latency histogram buckets (udp_latency_stats):
+//  bucket 0 is < 2us, bucket N is [2^N, 2^(N+1)) us, and the last bucket
+//  is open-ended
+#define UDP_LAT_BUCKETS 24
 
 // dnspacket-layer statistics, per-thread
 typedef struct {
@@ -39,11 +54,20 @@ typedef struct {
       satom_t tc;
       satom_t edns_big;
       satom_t edns_tc;
+      satom_t recv_width; // current recvmmsg() width (a gauge, not a counter)
+      satom_t batch[UDP_BATCH_BUCKETS];
+      satom_t busy_spin;  // udp_busy_poll_usecs: receives satisfied while spinning
+      satom_t busy_sleep; // udp_busy_poll_usecs: spins which gave up and blocked
+      satom_t latency[UDP_LAT_BUCKETS];
+      satom_t rrl_drop;   // rrl_responses_per_sec: responses not sent
+      satom_t rrl_slip;   // rrl_responses_per_sec: responses sent truncated
+      satom_t junk;       // dropped by udp_pkt_is_junk() (a subset of "dropped")
     } udp;
     struct { // TCP stats
       satom_t recvfail;
       satom_t recvsize;
       satom_t sendfail;
+      satom_t evicted;
     } tcp;
   } p;
 
@@ -69,20 +93,44 @@ typedef struct {
 
   // A percentage of "edns" above:
   satom_t edns_clientsub;
+
+  // response_cache_size: answers served from / missing in the cache
+  satom_t rcache_hit;
+  satom_t rcache_miss;
+
+  // dynamic_cache_size: plugin results served from / missing in the cache
+  satom_t dyncache_hit;
+  satom_t dyncache_miss;
 } dnspacket_stats_t;
 
+// One entry per name suffix stored uncompressed in the packet, in other
+//  words every offset a compression pointer could point at.
 typedef struct {
-    const uint8_t* original; // Alias to the original uncompressed dname's data (not the len byte)
-    const uint8_t* comp_ptr; // where compression occured on storage (could be off the end if uncompressed)
-    unsigned int stored_at; // offset this name was first stored to in the packet, possibly partially compressed
+    const uint8_t* suffix; // Alias to the original uncompressed dname's data, from the first label of this suffix
+    uint32_t gen;          // only valid if == c->comptarget_gen
+    uint32_t hash;         // of the suffix, see comptarget_hashes()
+    uint16_t len;          // of the suffix, including the terminal \0
+    uint16_t stored_at;    // packet offset of the suffix, always < 16384
 } comptarget_t;
 
+// Per-thread response cache entry (response_cache_size), private to dnspacket.c
+typedef struct _rcache_entry_struct rcache_entry_t;
+
 typedef struct {
     const ltree_rrset_addr_t* rrset;
     unsigned prev_offset; // offset into c->addtl_store before this rrset was added
     unsigned prev_arcount; // c->arcount before this rrset was added
 } addtl_rrset_t;
 
+// The labels of a name for search_ltree(): the offset of each label within
+//  the name data (left to right, with pos[count] the offset of the
+//  terminal \0), and each label's unmasked label_djb_hash_full().
+typedef struct {
+    unsigned count;
+    uint8_t pos[128];
+    uint32_t hash[127];
+} dname_labels_t;
+
 // DNS request context.  You must have a unique
 //  one of these for each thread that might call
 //  into process_dns_query().
@@ -101,15 +149,17 @@ typedef struct {
     unsigned int qtype;  // Same numeric values as RFC
     unsigned int qname_comp; // compression pointer for the current query name, starts at 0x000C, changes when following CNAME chains
     unsigned int auth_comp; // ditto, but points at an uncompressed version of the authority for the query name
+    dname_labels_t qlabels; // labels of the lowercased query name, from parse_question()
 
     // Stores information about each additional rrset processed
     addtl_rrset_t* addtl_rrsets;
 
-    // Compression offsets, these are one per domainname in the whole
-    //  packet.  Fully compressed names are not added, so this is really
-    //  the number of unique domainnames in a response packet, so 255
-    //  should be plenty.
+    // Compression targets: an open-addressed hash table of every name
+    //  suffix stored uncompressed in the packet so far.  Rather than clearing
+    //  it for each request, comptarget_gen is bumped, which invalidates all
+    //  entries from previous requests.
     comptarget_t* comptargets;
+    uint32_t comptarget_gen;
 
     // stats...
     dnspacket_stats_t* stats;
@@ -117,6 +167,16 @@ typedef struct {
     // used to pseudo-randomly rotate some RRsets (A, AAAA, NS, PTR)
     gdnsd_rstate_t* rand_state;
 
+    // UDP only, NULL if rrl_responses_per_sec is not set
+    rrl_table_t* rrl;
+
+    // NULL if response_cache_size is not set, rcache_mask is its size - 1
+    rcache_entry_t* rcache;
+    unsigned rcache_mask;
+
+    // NULL if dynamic_cache_size is not set
+    dyncache_t* dyncache;
+
     // Allocated at dnspacket startup, needs room for gconfig.max_cname_depth * 256
     uint8_t* dync_store;
 
@@ -130,12 +190,26 @@ typedef struct {
     // allocated at startup, memset to zero before each callback
     dynaddr_result_t* dynaddr;
 
+    // TCP only: the idle timeout to advertise via edns-tcp-keepalive,
+    //  in units of 100ms.  Kept current by the TCP I/O code.
+    unsigned edns_tcp_keepalive;
+
+    // Only used while pre-encoding static responses at load time
+    //  (preencode_answers): rotated rrsets start at render_rot instead
+    //  of a random index, render_period accumulates the number of distinct
+    //  rotations of the response, and render_failed is set if the response
+    //  can't be pre-encoded (dynamic data, or too many rotations).
+    bool rendering;
+    bool render_failed;
+    unsigned render_rot;
+    unsigned render_period;
+
 // From this point (answer_addr_rrset) on, all of this gets reset to zero
 //  at the start of each request...
 
     const ltree_rrset_addr_t* answer_addr_rrset;
     client_info_t client_info; // dns source IP + optional EDNS client subnet info for plugins
-    unsigned int comptarget_count; // unique domainnames stored to the packet, including the original question
+    unsigned int comptarget_count; // entries in comptargets for this request, including the original question
     unsigned int dync_count; // how many results have been stored to dync_store so far
     unsigned int addtl_count; // count of addtl's in addtl_rrsets
     unsigned int addtl_offset; // current offset writing into addtl_store
@@ -155,12 +229,26 @@ typedef struct {
     // Whether additional section contains glue (can't be silently truncated)
     bool addtl_has_glue;
 
+    // The answer depended on a plugin (so it can't be cached), or
+    //  pseudo-randomly rotated an rrset (so it's cached in several variants)
+    bool answer_dynamic;
+    bool answer_rotated;
+
+    // While filling a response cache entry, rrsets rotate by rot_base
+    //  (mod their size) rather than at random, so that the variants of
+    //  a cached answer are distinct rotations of it
+    bool rot_fixed;
+    uint32_t rot_base;
+
     // Whether this request had a valid EDNS0 optrr
     bool use_edns;
 
     // Client sent EDNS Client Subnet option, and we must respond with one
     bool use_edns_client_subnet;
 
+    // Client sent edns-tcp-keepalive over TCP, and we must respond with one
+    bool use_edns_tcp_keepalive;
+
     // If this is true, the query class was CH
     bool chaos;
 } dnspacket_context_t;
@@ -168,9 +256,24 @@ typedef struct {
 F_NONNULL
 unsigned int process_dns_query(dnspacket_context_t* c, const anysin_t* asin, uint8_t* packet, const unsigned int packet_len);
 
+// Processes "count" queries at once, with the same per-query semantics
+//  as process_dns_query(): lens[i] is the length of packets[i] on input,
+//  and the response length (or zero for no response) on output.
+//  Entries with an input length of zero are skipped, and stay zero.
+//  Lookups for all of the queries are overlapped to hide memory latency.
+F_NONNULL
+void process_dns_query_batch(dnspacket_context_t* c, const unsigned count, const anysin_t* asins, uint8_t* const* packets, unsigned* lens);
+
 F_MALLOC F_WUNUSED
 dnspacket_context_t* dnspacket_context_new(const unsigned int this_threadnum, const bool is_udp);
 
+// Called by ltree_load_zones() for each authoritative node when
+//  preencode_answers is set.  "dname" is the node's full name.  Attaches
+//  pre-encoded responses for the static rrsets at the node to node->tmpls,
+//  and returns how many were created.
+F_NONNULL
+unsigned dnspacket_preencode_node(ltree_node_t* node, const uint8_t* dname);
+
 void dnspacket_global_setup(void);
 void dnspacket_wait_stats(void);
 
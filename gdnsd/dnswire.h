@@ -112,6 +112,9 @@ typedef struct {
 // NOT ASSIGNED BY IANA!:
 #define EDNS_CLIENTSUB_OPTCODE 0x50fa
 
+// RFC 7828
+#define EDNS_TCP_KEEPALIVE_OPTCODE 11
+
 /* DNS RR Types */
 #define DNS_TYPE_A	1
 #define DNS_TYPE_NS	2
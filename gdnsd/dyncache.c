@@ -0,0 +1,330 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "dyncache.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "conf.h"
+#include "gdnsd-plugapi-priv.h"
+
+/*
+ * The entries live in a 4-way set-associative table.  A key hashes to a
+ *  set of adjacent entries using only the first 16 (IPv4) or 32 (IPv6)
+ *  bits of the edns-client-subnet address, so that results with a scope
+ *  at least that short are shared by all of the addresses within it, while
+ *  results with longer scopes from the same network sit side by side in
+ *  the set.  A new result replaces an invalid entry of the set if there is
+ *  one, or else the one which will expire soonest.
+ */
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#  define DYNCACHE_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#  define DYNCACHE_CLOCK CLOCK_MONOTONIC
+#endif
+
+#define DYNCACHE_WAYS 4
+#define DYNCACHE_HASH_BITS_V4 16
+#define DYNCACHE_HASH_BITS_V6 32
+
+// Room for e.g. 8 IPv4 + 10 IPv6 addresses, or a 192-byte CNAME
+#define DYNCACHE_DATA 192
+
+typedef struct {
+    const void* rrset;   // NULL for an unused entry
+    uintptr_t gen;       // gdnsd_plugins_results_gen() before the plugin was called
+    uint32_t expires_ms;
+    uint32_t ttl;
+    uint8_t src[16];     // dns_source address (IPv4 in the first 4 bytes)
+    uint8_t net[16];     // edns_client address masked to "scope"
+    uint8_t src_v6;
+    uint8_t ecs_fam;     // 0 (no edns-client-subnet), 4, or 6
+    uint8_t ecs_mask;    // edns_client_mask
+    uint8_t scope;       // the result's edns_scope_mask
+    uint8_t count_v4;
+    uint8_t count_v6;
+    uint8_t data[DYNCACHE_DATA]; // IPv4 then IPv6 addresses, or a dname
+} dyncache_entry_t;
+
+// The parts of the key which come from the client_info_t
+typedef struct {
+    uint8_t src[16];
+    uint8_t ecs[16];
+    uint8_t src_v6;
+    uint8_t ecs_fam;
+    uint8_t ecs_mask;
+} dyncache_key_t;
+
+struct _dyncache_t {
+    dyncache_entry_t* entries;
+    uint64_t seed;
+    unsigned mask;        // entries - 1, with the low bits clear (set index)
+    uint32_t lifetime_ms; // dynamic_cache_secs
+    // Saved by a missed lookup, for the dyncache_put_*() that follows it
+    const void* miss_rrset;
+    dyncache_entry_t* miss_set;
+    uintptr_t miss_gen;
+    uint32_t miss_now_ms;
+    dyncache_key_t miss_key;
+};
+
+F_CONST
+static inline uint64_t dyncache_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint32_t dyncache_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(DYNCACHE_CLOCK, &ts);
+    return (uint32_t)(((uint64_t)ts.tv_sec * 1000U) + ((uint64_t)ts.tv_nsec / 1000000U));
+}
+
+dyncache_t* dyncache_new(gdnsd_rstate_t* rs) {
+    dmn_assert(rs);
+    dmn_assert(gconfig.dynamic_cache_size);
+
+    dyncache_t* t = calloc(1, sizeof(dyncache_t));
+
+    unsigned size = DYNCACHE_WAYS;
+    while(size < gconfig.dynamic_cache_size)
+        size <<= 1;
+    t->entries = calloc(size, sizeof(dyncache_entry_t));
+    t->mask = (size - 1) & ~(DYNCACHE_WAYS - 1U);
+    t->seed = gdnsd_rand_get64(rs);
+    t->lifetime_ms = gconfig.dynamic_cache_secs * 1000U;
+
+    return t;
+}
+
+// Copies the first "bits" bits of the "bytes"-long address "in" to "out",
+//  zeroing the rest
+F_NONNULL
+static void mask_addr(uint8_t* out, const uint8_t* in, const unsigned bytes, const unsigned bits) {
+    dmn_assert(out); dmn_assert(in); dmn_assert(bits <= bytes * 8);
+    const unsigned whole = bits >> 3;
+    memcpy(out, in, whole);
+    if(whole < bytes) {
+        out[whole] = in[whole] & (uint8_t)(0xFF00U >> (bits & 7));
+        memset(&out[whole + 1], 0, bytes - whole - 1);
+    }
+}
+
+F_NONNULL
+static void key_init(dyncache_key_t* k, const client_info_t* cinfo) {
+    dmn_assert(k); dmn_assert(cinfo);
+
+    memset(k, 0, sizeof(dyncache_key_t));
+    if(cinfo->dns_source.sa.sa_family == AF_INET6) {
+        k->src_v6 = 1;
+        memcpy(k->src, cinfo->dns_source.sin6.sin6_addr.s6_addr, 16);
+    }
+    else {
+        dmn_assert(cinfo->dns_source.sa.sa_family == AF_INET);
+        memcpy(k->src, &cinfo->dns_source.sin.sin_addr.s_addr, 4);
+    }
+
+    // A zero mask means there's no usable edns-client-subnet data
+    if(cinfo->edns_client_mask) {
+        k->ecs_mask = cinfo->edns_client_mask;
+        if(cinfo->edns_client.sa.sa_family == AF_INET6) {
+            k->ecs_fam = 6;
+            memcpy(k->ecs, cinfo->edns_client.sin6.sin6_addr.s6_addr, 16);
+        }
+        else {
+            dmn_assert(cinfo->edns_client.sa.sa_family == AF_INET);
+            k->ecs_fam = 4;
+            memcpy(k->ecs, &cinfo->edns_client.sin.sin_addr.s_addr, 4);
+        }
+    }
+}
+
+F_NONNULL F_PURE
+static dyncache_entry_t* find_set(const dyncache_t* t, const void* rrset, const dyncache_key_t* k) {
+    dmn_assert(t); dmn_assert(rrset); dmn_assert(k);
+
+    uint64_t src[2];
+    memcpy(src, k->src, sizeof(src));
+    uint64_t h = dyncache_mix(t->seed ^ (uint64_t)(uintptr_t)rrset);
+    h = dyncache_mix(h ^ src[0]);
+    h = dyncache_mix(h ^ src[1] ^ ((uint64_t)k->src_v6 << 32));
+
+    uint32_t ecs_word = 0;
+    if(k->ecs_fam) {
+        const unsigned hash_bits = k->ecs_fam == 4 ? DYNCACHE_HASH_BITS_V4 : DYNCACHE_HASH_BITS_V6;
+        uint8_t ecs_pfx[4];
+        mask_addr(ecs_pfx, k->ecs, 4, k->ecs_mask < hash_bits ? k->ecs_mask : hash_bits);
+        memcpy(&ecs_word, ecs_pfx, 4);
+    }
+    h = dyncache_mix(h ^ ecs_word ^ ((uint64_t)k->ecs_fam << 32) ^ ((uint64_t)k->ecs_mask << 40));
+
+    return &t->entries[h & t->mask];
+}
+
+F_NONNULL F_PURE
+static bool entry_matches(const dyncache_entry_t* e, const void* rrset, const dyncache_key_t* k, const uintptr_t gen, const uint32_t now_ms) {
+    dmn_assert(e); dmn_assert(rrset); dmn_assert(k);
+
+    if(e->rrset != rrset || e->gen != gen || (int32_t)(e->expires_ms - now_ms) <= 0)
+        return false;
+    if(e->src_v6 != k->src_v6 || memcmp(e->src, k->src, 16))
+        return false;
+    if(e->ecs_fam != k->ecs_fam || e->ecs_mask != k->ecs_mask)
+        return false;
+    if(k->ecs_fam) {
+        const unsigned bytes = k->ecs_fam == 4 ? 4 : 16;
+        uint8_t net[16];
+        mask_addr(net, k->ecs, bytes, e->scope);
+        if(memcmp(net, e->net, bytes))
+            return false;
+    }
+    return true;
+}
+
+// Looks up rrset+cinfo, saving what dyncache_put_*() needs on a miss
+F_NONNULL
+static const dyncache_entry_t* dyncache_get(dyncache_t* t, const void* rrset, const client_info_t* cinfo) {
+    dmn_assert(t); dmn_assert(rrset); dmn_assert(cinfo);
+
+    // Sampled before the plugin is called on a miss, so that a state
+    //  change during the call leaves the stored result already stale
+    const uintptr_t gen = gdnsd_plugins_results_gen();
+    const uint32_t now_ms = dyncache_now_ms();
+
+    dyncache_key_t* k = &t->miss_key;
+    key_init(k, cinfo);
+    dyncache_entry_t* set = find_set(t, rrset, k);
+    for(unsigned i = 0; i < DYNCACHE_WAYS; i++)
+        if(entry_matches(&set[i], rrset, k, gen, now_ms))
+            return &set[i];
+
+    t->miss_rrset = rrset;
+    t->miss_set = set;
+    t->miss_gen = gen;
+    t->miss_now_ms = now_ms;
+    return NULL;
+}
+
+// Picks the entry to replace in the set of the last miss, and fills in
+//  its key, or returns NULL if the result's scope makes no sense
+F_NONNULL
+static dyncache_entry_t* dyncache_put(dyncache_t* t, const void* rrset, const unsigned scope) {
+    dmn_assert(t); dmn_assert(rrset);
+    dmn_assert(rrset == t->miss_rrset);
+
+    const dyncache_key_t* k = &t->miss_key;
+    const unsigned bytes = k->ecs_fam == 6 ? 16 : 4;
+    if(scope > bytes * 8)
+        return NULL;
+
+    dyncache_entry_t* set = t->miss_set;
+    dyncache_entry_t* e = &set[0];
+    for(unsigned i = 0; i < DYNCACHE_WAYS; i++) {
+        dyncache_entry_t* this_e = &set[i];
+        if(!this_e->rrset || this_e->gen != t->miss_gen || (int32_t)(this_e->expires_ms - t->miss_now_ms) <= 0) {
+            e = this_e;
+            break;
+        }
+        if((int32_t)(this_e->expires_ms - e->expires_ms) < 0)
+            e = this_e;
+    }
+
+    e->rrset = rrset;
+    e->gen = t->miss_gen;
+    e->expires_ms = t->miss_now_ms + t->lifetime_ms;
+    memcpy(e->src, k->src, 16);
+    e->src_v6 = k->src_v6;
+    e->ecs_fam = k->ecs_fam;
+    e->ecs_mask = k->ecs_mask;
+    e->scope = scope;
+    memset(e->net, 0, 16);
+    if(k->ecs_fam)
+        mask_addr(e->net, k->ecs, bytes, scope);
+
+    t->miss_rrset = NULL;
+    return e;
+}
+
+bool dyncache_get_addr(dyncache_t* t, const void* rrset, const client_info_t* cinfo, dynaddr_result_t* result) {
+    dmn_assert(t); dmn_assert(rrset); dmn_assert(cinfo); dmn_assert(result);
+
+    const dyncache_entry_t* e = dyncache_get(t, rrset, cinfo);
+    if(!e)
+        return false;
+
+    result->ttl = e->ttl;
+    result->edns_scope_mask = e->scope;
+    result->count_v4 = e->count_v4;
+    result->count_v6 = e->count_v6;
+    const unsigned v4_bytes = e->count_v4 * 4U;
+    memcpy(result->addrs_v4, e->data, v4_bytes);
+    memcpy(result->addrs_v6, &e->data[v4_bytes], e->count_v6 * 16U);
+    return true;
+}
+
+void dyncache_put_addr(dyncache_t* t, const void* rrset, const client_info_t* cinfo V_UNUSED, const dynaddr_result_t* result) {
+    dmn_assert(t); dmn_assert(rrset); dmn_assert(cinfo); dmn_assert(result);
+
+    const unsigned v4_bytes = result->count_v4 * 4U;
+    const unsigned v6_bytes = result->count_v6 * 16U;
+    if(v4_bytes + v6_bytes > DYNCACHE_DATA)
+        return;
+
+    dyncache_entry_t* e = dyncache_put(t, rrset, result->edns_scope_mask);
+    if(e) {
+        e->ttl = result->ttl;
+        e->count_v4 = result->count_v4;
+        e->count_v6 = result->count_v6;
+        memcpy(e->data, result->addrs_v4, v4_bytes);
+        memcpy(&e->data[v4_bytes], result->addrs_v6, v6_bytes);
+    }
+}
+
+bool dyncache_get_cname(dyncache_t* t, const void* rrset, const client_info_t* cinfo, dyncname_result_t* result) {
+    dmn_assert(t); dmn_assert(rrset); dmn_assert(cinfo); dmn_assert(result);
+
+    const dyncache_entry_t* e = dyncache_get(t, rrset, cinfo);
+    if(!e)
+        return false;
+
+    result->ttl = e->ttl;
+    result->edns_scope_mask = e->scope;
+    gdnsd_dname_copy(result->dname, e->data);
+    return true;
+}
+
+void dyncache_put_cname(dyncache_t* t, const void* rrset, const client_info_t* cinfo V_UNUSED, const dyncname_result_t* result) {
+    dmn_assert(t); dmn_assert(rrset); dmn_assert(cinfo); dmn_assert(result);
+
+    if(*result->dname + 1U > DYNCACHE_DATA)
+        return;
+
+    dyncache_entry_t* e = dyncache_put(t, rrset, result->edns_scope_mask);
+    if(e) {
+        e->ttl = result->ttl;
+        e->count_v4 = e->count_v6 = 0;
+        gdnsd_dname_copy(e->data, result->dname);
+    }
+}
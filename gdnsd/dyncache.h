@@ -0,0 +1,66 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _GDNSD_DYNCACHE_H
+#define _GDNSD_DYNCACHE_H
+
+#include "config.h"
+#include "gdnsd.h"
+#include "gdnsd-misc.h"
+
+// Per-thread cache of DYNA/DYNC plugin results (dynamic_cache_size), for
+//  plugins which set GDNSD_PLUGIN_FLAG_CACHE_RESULTS.  Each DNS I/O thread
+//  owns one, so no locking is involved.
+//
+// A result is keyed on the rrset it was resolved for (which determines the
+//  plugin, resource, origin and zonefile TTL), the querying cache's address,
+//  and the edns-client-subnet family and source mask, and it matches any
+//  edns-client-subnet address equal to the original one within the result's
+//  edns_scope_mask.  The cache's address is matched exactly, because
+//  plugins report a zero scope for results based on it.
+//
+// Results expire after dynamic_cache_secs, and are invalidated early by
+//  any gdnsd_plugins_results_changed() (e.g. every monitoring state change).
+//  Results with too many addresses to fit in an entry aren't cached.
+
+typedef struct _dyncache_t dyncache_t;
+
+// Called by each DNS I/O thread when dynamic_cache_size is set,
+//  rs provides the per-thread hash seed
+F_NONNULL F_MALLOC F_WUNUSED
+dyncache_t* dyncache_new(gdnsd_rstate_t* rs);
+
+// Look up a cached result for "rrset" (a DYNA rrset for _addr, DYNC for
+//  _cname) and "cinfo".  On a hit, fills in "result" (only the first
+//  count_v4/count_v6 addresses, in the _addr case) and returns true.
+//  On a miss, the plugin should be called and its result handed to the
+//  matching dyncache_put_*() before any other dyncache call.
+F_NONNULL
+bool dyncache_get_addr(dyncache_t* t, const void* rrset, const client_info_t* cinfo, dynaddr_result_t* result);
+F_NONNULL
+bool dyncache_get_cname(dyncache_t* t, const void* rrset, const client_info_t* cinfo, dyncname_result_t* result);
+
+// Store the plugin's result after a dyncache_get_*() miss for the same
+//  rrset and cinfo.
+F_NONNULL
+void dyncache_put_addr(dyncache_t* t, const void* rrset, const client_info_t* cinfo, const dynaddr_result_t* result);
+F_NONNULL
+void dyncache_put_cname(dyncache_t* t, const void* rrset, const client_info_t* cinfo, const dyncname_result_t* result);
+
+#endif // _GDNSD_DYNCACHE_H
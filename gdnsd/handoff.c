@@ -0,0 +1,388 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "handoff.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "conf.h"
+
+/*
+ * The protocol is trivial: after accepting a connection, the old daemon
+ *  sends a series of fixed-size headers, each carrying up to
+ *  HANDOFF_MAX_FDS sockets as SCM_RIGHTS data, followed by a final
+ *  header with a zero count, and closes the connection.  The receiver
+ *  identifies each socket by asking the kernel for its type and bound
+ *  address, so nothing else about the old daemon's config matters.
+ */
+
+#define HANDOFF_MAX_FDS 32
+#define HANDOFF_TIMEOUT_SECS 5
+
+static const char handoff_magic[8] = { 'g', 'd', 'n', 's', 'd', 'H', 'O', '1' };
+
+typedef struct {
+    char magic[8];
+    uint32_t count;
+} handoff_hdr_t;
+
+typedef struct {
+    anysin_t addr;
+    int sock;
+    bool is_udp;
+    bool reuseport;
+} handoff_sock_t;
+
+// Received sockets, in the new daemon
+static handoff_sock_t* rcvd = NULL;
+static unsigned num_rcvd = 0;
+
+// Our own unix listening socket, for the next restart
+static int listen_fd = -1;
+static ev_io* accept_watcher = NULL;
+
+// The unix socket lives next to the pidfile, so that separate instances
+//  with separate pidfiles can't talk to each other
+static bool handoff_path(struct sockaddr_un* sun) {
+    dmn_assert(sun);
+    memset(sun, 0, sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    const int len = snprintf(sun->sun_path, sizeof(sun->sun_path), "%s.handoff", gconfig.pidfile);
+    if(len < 0 || (size_t)len >= sizeof(sun->sun_path)) {
+        log_warn("restart_handoff: path '%s.handoff' is too long for a unix socket", gconfig.pidfile);
+        return false;
+    }
+    return true;
+}
+
+static void set_timeout(const int fd, const int opt) {
+    const struct timeval tv = { .tv_sec = HANDOFF_TIMEOUT_SECS, .tv_usec = 0 };
+    if(setsockopt(fd, SOL_SOCKET, opt, &tv, sizeof(tv)))
+        log_warn("restart_handoff: setsockopt(SO_%sTIMEO) failed: %s", opt == SO_RCVTIMEO ? "RCV" : "SND", logf_errno());
+}
+
+/*** New daemon side ***/
+
+// Records one received socket, or closes it if it's not one we can use
+static void handoff_add_rcvd(const int sock) {
+    handoff_sock_t* hs = &rcvd[num_rcvd];
+    memset(hs, 0, sizeof(*hs));
+
+    int type = 0;
+    socklen_t optlen = sizeof(type);
+    hs->addr.len = ANYSIN_MAXLEN;
+    if(getsockopt(sock, SOL_SOCKET, SO_TYPE, &type, &optlen)
+        || (type != SOCK_DGRAM && type != SOCK_STREAM)
+        || getsockname(sock, &hs->addr.sa, &hs->addr.len)
+        || (hs->addr.sa.sa_family != AF_INET && hs->addr.sa.sa_family != AF_INET6)
+        || !(hs->addr.sa.sa_family == AF_INET ? hs->addr.sin.sin_port : hs->addr.sin6.sin6_port)) {
+        close(sock); // unbound (late_bind_secs) or otherwise unusable
+        return;
+    }
+
+#ifdef SO_REUSEPORT
+    int reuseport = 0;
+    optlen = sizeof(reuseport);
+    if(!getsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuseport, &optlen))
+        hs->reuseport = !!reuseport;
+#endif
+
+    hs->sock = sock;
+    hs->is_udp = (type == SOCK_DGRAM);
+    num_rcvd++;
+}
+
+static void handoff_abort(void) {
+    for(unsigned i = 0; i < num_rcvd; i++)
+        close(rcvd[i].sock);
+    free(rcvd);
+    rcvd = NULL;
+    num_rcvd = 0;
+}
+
+void handoff_receive(void) {
+    dmn_assert(!rcvd);
+
+    struct sockaddr_un sun;
+    if(!handoff_path(&sun))
+        return;
+
+    const int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(conn < 0) {
+        log_warn("restart_handoff: socket(AF_UNIX) failed: %s", logf_errno());
+        return;
+    }
+
+    if(connect(conn, (const struct sockaddr*)&sun, sizeof(sun))) {
+        log_info("restart_handoff: no running daemon accepting handoff at %s (%s), doing a normal restart", sun.sun_path, logf_errno());
+        close(conn);
+        return;
+    }
+
+    set_timeout(conn, SO_RCVTIMEO);
+
+    unsigned alloc = HANDOFF_MAX_FDS;
+    rcvd = malloc(alloc * sizeof(handoff_sock_t));
+
+    while(1) {
+        handoff_hdr_t hdr;
+        struct iovec iov = { .iov_base = &hdr, .iov_len = sizeof(hdr) };
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        } cmsg_u;
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = cmsg_u.buf;
+        mh.msg_controllen = sizeof(cmsg_u.buf);
+
+        const ssize_t len = recvmsg(conn, &mh, MSG_WAITALL);
+
+        // Take any sockets first, so that errors can't leak them
+        unsigned nfds = 0;
+        for(struct cmsghdr* cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+                const unsigned n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                if(num_rcvd + n > alloc) {
+                    alloc = (num_rcvd + n) * 2;
+                    rcvd = realloc(rcvd, alloc * sizeof(handoff_sock_t));
+                }
+                for(unsigned i = 0; i < n; i++) {
+                    int fd;
+                    memcpy(&fd, CMSG_DATA(cm) + (i * sizeof(int)), sizeof(int));
+                    handoff_add_rcvd(fd);
+                }
+                nfds += n;
+            }
+        }
+
+        if(len != sizeof(hdr) || memcmp(hdr.magic, handoff_magic, sizeof(handoff_magic))
+            || (mh.msg_flags & MSG_CTRUNC) || hdr.count != nfds) {
+            log_warn("restart_handoff: bad or incomplete handoff from running daemon (%s), doing a normal restart",
+                len < 0 ? logf_errno() : "protocol error");
+            handoff_abort();
+            close(conn);
+            return;
+        }
+
+        if(!hdr.count)
+            break;
+    }
+
+    close(conn);
+    log_info("restart_handoff: received %u listening sockets from the running daemon", num_rcvd);
+}
+
+F_NONNULL F_PURE
+static bool same_addr(const anysin_t* a, const anysin_t* b) {
+    dmn_assert(a); dmn_assert(b);
+    if(a->sa.sa_family != b->sa.sa_family)
+        return false;
+    if(a->sa.sa_family == AF_INET6)
+        return a->sin6.sin6_port == b->sin6.sin6_port
+            && !memcmp(&a->sin6.sin6_addr, &b->sin6.sin6_addr, sizeof(a->sin6.sin6_addr));
+    return a->sin.sin_port == b->sin.sin_port
+        && a->sin.sin_addr.s_addr == b->sin.sin_addr.s_addr;
+}
+
+int handoff_take_sock(const anysin_t* asin, const bool is_udp, const bool need_reuseport) {
+    dmn_assert(asin);
+
+    for(unsigned i = 0; i < num_rcvd; i++) {
+        handoff_sock_t* hs = &rcvd[i];
+        if(hs->sock >= 0 && hs->is_udp == is_udp
+            && (hs->reuseport || !need_reuseport)
+            && same_addr(&hs->addr, asin)) {
+            const int sock = hs->sock;
+            hs->sock = -1;
+            return sock;
+        }
+    }
+
+    return -1;
+}
+
+void handoff_close_unclaimed(void) {
+    unsigned unclaimed = 0;
+    for(unsigned i = 0; i < num_rcvd; i++) {
+        if(rcvd[i].sock >= 0) {
+            close(rcvd[i].sock);
+            unclaimed++;
+        }
+    }
+
+    if(unclaimed)
+        log_info("restart_handoff: closed %u received sockets which the new configuration does not use", unclaimed);
+
+    free(rcvd);
+    rcvd = NULL;
+    num_rcvd = 0;
+}
+
+/*** Old daemon side ***/
+
+F_NONNULL
+static bool handoff_send(const int conn, const int* fds, const unsigned count) {
+    dmn_assert(conn >= 0); dmn_assert(count <= HANDOFF_MAX_FDS);
+
+    handoff_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, handoff_magic, sizeof(handoff_magic));
+    hdr.count = count;
+
+    struct iovec iov = { .iov_base = &hdr, .iov_len = sizeof(hdr) };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    } cmsg_u;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+
+    if(count) {
+        mh.msg_control = cmsg_u.buf;
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * count);
+    }
+
+    return sendmsg(conn, &mh, 0) == (ssize_t)sizeof(hdr);
+}
+
+// Only root, or the user we run as, may take our sockets.  On platforms
+//  without SO_PEERCRED, the socket file's 0600 mode has to suffice.
+static bool handoff_peer_ok(const int conn) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len)) {
+        log_err("restart_handoff: getsockopt(SO_PEERCRED) failed: %s", logf_errno());
+        return false;
+    }
+    if(cred.uid && cred.uid != geteuid()) {
+        log_err("restart_handoff: refusing handoff to pid %li running as uid %li", (long)cred.pid, (long)cred.uid);
+        return false;
+    }
+#endif
+    return true;
+}
+
+F_NONNULL
+static void handoff_accept(struct ev_loop* loop V_UNUSED, ev_io* w, const int revents V_UNUSED) {
+    dmn_assert(w); dmn_assert(revents == EV_READ);
+
+    const int conn = accept(w->fd, NULL, NULL);
+    if(conn < 0) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            log_err("restart_handoff: accept() failed: %s", logf_errno());
+        return;
+    }
+
+    // The connection is from a local process which is already waiting
+    //  for us, so it's simplest to just block here briefly
+    if(fcntl(conn, F_SETFL, (fcntl(conn, F_GETFL, 0)) & ~O_NONBLOCK) == -1)
+        log_err("restart_handoff: failed to clear O_NONBLOCK: %s", logf_errno());
+    set_timeout(conn, SO_SNDTIMEO);
+
+    if(handoff_peer_ok(conn)) {
+        int fds[HANDOFF_MAX_FDS];
+        unsigned count = 0;
+        unsigned sent = 0;
+        bool ok = true;
+        const unsigned num_socks = gconfig.num_dns_threads;
+        for(unsigned i = 0; ok && i < num_socks; i++) {
+            const dns_thread_t* t = &gconfig.dns_threads[i];
+            if(t->sock < 0)
+                continue;
+            fds[count++] = t->sock;
+            if(count == HANDOFF_MAX_FDS) {
+                ok = handoff_send(conn, fds, count);
+                sent += count;
+                count = 0;
+            }
+        }
+        if(ok && count) {
+            ok = handoff_send(conn, fds, count);
+            sent += count;
+        }
+        if(ok)
+            ok = handoff_send(conn, fds, 0);
+
+        if(ok)
+            log_info("restart_handoff: passed %u listening sockets to a new daemon instance", sent);
+        else
+            log_err("restart_handoff: sending listening sockets failed: %s", logf_errno());
+    }
+
+    close(conn);
+}
+
+void handoff_listen_init(void) {
+    struct sockaddr_un sun;
+    if(!handoff_path(&sun))
+        return;
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        log_fatal("restart_handoff: socket(AF_UNIX) failed: %s", logf_errno());
+    if(fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+        log_fatal("restart_handoff: failed to set FD_CLOEXEC: %s", logf_errno());
+    if(fcntl(fd, F_SETFL, (fcntl(fd, F_GETFL, 0)) | O_NONBLOCK) == -1)
+        log_fatal("restart_handoff: failed to set O_NONBLOCK: %s", logf_errno());
+
+    // A previous instance's socket (if any) is no longer needed, since
+    //  we either already took its listeners or it's not running
+    if(unlink(sun.sun_path) && errno != ENOENT)
+        log_fatal("restart_handoff: cannot unlink old socket %s: %s", sun.sun_path, logf_errno());
+
+    const mode_t old_umask = umask(077);
+    const int bind_rv = bind(fd, (const struct sockaddr*)&sun, sizeof(sun));
+    umask(old_umask);
+    if(bind_rv)
+        log_fatal("restart_handoff: cannot bind unix socket %s: %s", sun.sun_path, logf_errno());
+    if(listen(fd, 1))
+        log_fatal("restart_handoff: listen() on %s failed: %s", sun.sun_path, logf_errno());
+
+    listen_fd = fd;
+}
+
+void handoff_start(struct ev_loop* loop) {
+    dmn_assert(loop);
+
+    if(listen_fd < 0)
+        return;
+
+    accept_watcher = malloc(sizeof(ev_io));
+    ev_io_init(accept_watcher, handoff_accept, listen_fd, EV_READ);
+    ev_io_start(loop, accept_watcher);
+}
@@ -0,0 +1,55 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _GDNSD_HANDOFF_H
+#define _GDNSD_HANDOFF_H
+
+#include "config.h"
+#include "gdnsd.h"
+
+// restart_handoff: a running daemon passes its bound DNS listening
+//  sockets over a unix socket (next to the pidfile) to the new daemon
+//  being started by "restart", so that requests which arrive while
+//  the old daemon exits are queued for the new one rather than lost.
+
+// New daemon: called by main() before dmn_daemonize() on restart.
+//  Connects to the running daemon and receives its listening sockets.
+//  Failure just means a normal restart, so it's logged, not fatal.
+void handoff_receive(void);
+
+// New daemon: called by dns_lsock_init() for each dns_threads entry
+//  before any sockets are created, to claim a received socket bound to
+//  the same address and protocol (-1 if none).  If need_reuseport is
+//  true, sockets without SO_REUSEPORT don't match.
+F_NONNULL
+int handoff_take_sock(const anysin_t* asin, const bool is_udp, const bool need_reuseport);
+
+// New daemon: closes any received sockets not claimed above, which
+//  must happen before any new sockets are bound.
+void handoff_close_unclaimed(void);
+
+// Creates the unix socket for passing our own listeners to a future
+//  restart.  Called by main() while still privileged (before chroot).
+void handoff_listen_init(void);
+
+// Starts serving the unix socket from above in the main thread's loop
+F_NONNULL
+void handoff_start(struct ev_loop* loop);
+
+#endif // _GDNSD_HANDOFF_H
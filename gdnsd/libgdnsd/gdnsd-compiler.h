@@ -34,6 +34,7 @@
 #  define F_PURE          __attribute__((__pure__))
 #  define F_MALLOC        __attribute__((__malloc__))
 #  define F_NORETURN      __attribute__((__noreturn__))
+#  define PREFETCH(x)     __builtin_prefetch(x)
 #  if __GNUC__ > 3 || __GNUC_MINOR__ > 2 // gcc 3.3+
 #    define F_NONNULLX(...) __attribute__((__nonnull__(__VA_ARGS__)))
 #    define F_NONNULL       __attribute__((__nonnull__))
@@ -56,6 +57,7 @@
 #  define F_PURE
 #  define F_MALLOC
 #  define F_NORETURN
+#  define PREFETCH(x)     ((void)(x))
 #  define F_NONNULLX(...)
 #  define F_NONNULL
 #  define F_WUNUSED
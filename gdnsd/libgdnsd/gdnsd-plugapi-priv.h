@@ -46,4 +46,8 @@ void gdnsd_plugins_action_pre_run(struct ev_loop* loop);
 void gdnsd_plugins_action_iothread_init(const unsigned threadnum);
 void gdnsd_plugins_action_exit(void);
 
+// Bumped by every gdnsd_plugins_results_changed(), so that cached
+//  plugin results are only valid while this is unchanged
+uintptr_t gdnsd_plugins_results_gen(void);
+
 #endif // _GDNSD_PLUGINAPI_PRIV_H
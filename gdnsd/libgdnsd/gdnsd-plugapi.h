@@ -82,6 +82,7 @@ void gdnsd_dynaddr_add_result_anysin(dynaddr_result_t* result, const anysin_t* a
 /**** Typedefs for plugin callbacks ****/
 
 typedef unsigned (*gdnsd_apiv_cb_t)(void);
+typedef unsigned (*gdnsd_get_flags_cb_t)(void);
 typedef monio_list_t* (*gdnsd_load_config_cb_t)(const vscf_data_t* pc);
 typedef unsigned (*gdnsd_map_resource_dyna_cb_t)(const char* resname);
 typedef unsigned (*gdnsd_map_resource_dync_cb_t)(const char* resname, const uint8_t* origin);
@@ -93,6 +94,16 @@ typedef bool (*gdnsd_resolve_dynaddr_cb_t)(unsigned threadnum, unsigned resnum,
 typedef void (*gdnsd_resolve_dyncname_cb_t)(unsigned threadnum, unsigned resnum, const uint8_t* origin, const client_info_t* cinfo, dyncname_result_t* result);
 typedef void (*gdnsd_exit_cb_t)(void);
 
+// Flag bits for plugin_foo_get_flags()
+
+// The plugin's resolve_dynaddr/resolve_dyncname results are a pure
+//  function of (resnum, origin, cinfo) and of monitored state (or other
+//  state whose changes are announced via gdnsd_plugins_results_changed()),
+//  so the core may re-use a result for a short time for other queries
+//  from the same cache whose edns-client-subnet address matches the
+//  result's edns_scope_mask.
+#define GDNSD_PLUGIN_FLAG_CACHE_RESULTS 1U
+
 /**** New callbacks for monitoring plugins ****/
 
 typedef void (*gdnsd_add_svctype_cb_t)(const char* name, const vscf_data_t* svc_cfg, const unsigned interval, const unsigned timeout);
@@ -104,6 +115,7 @@ typedef void (*gdnsd_start_monitors_cb_t)(struct ev_loop* mon_loop);
 //  pointers for all of the possibly documented callbacks
 typedef struct {
     const char* name;
+    gdnsd_get_flags_cb_t get_flags;
     gdnsd_load_config_cb_t load_config;
     gdnsd_full_config_cb_t full_config;
     gdnsd_map_resource_dyna_cb_t map_resource_dyna;
@@ -125,4 +137,10 @@ typedef struct {
 F_NONNULL F_PURE
 const plugin_t* gdnsd_plugin_find(const char* plugin_name);
 
+// Tell the core that something other than monitored state (which is
+//  handled automatically) has changed the results a plugin using
+//  GDNSD_PLUGIN_FLAG_CACHE_RESULTS would return, e.g. a reloaded database.
+//  Safe to call from any thread, at any time.
+void gdnsd_plugins_results_changed(void);
+
 #endif // _GDNSD_PLUGINAPI_H
@@ -46,6 +46,7 @@
  */
 
 #define xSYM_GET_APIV(x)      plugin_ ## x ## _get_api_version
+#define xSYM_GET_FLAGS(x)     plugin_ ## x ## _get_flags
 #define xSYM_LOAD_CONFIG(x)   plugin_ ## x ## _load_config
 #define xSYM_MAP_RESOURCEA(x) plugin_ ## x ## _map_resource_dyna
 #define xSYM_MAP_RESOURCEC(x) plugin_ ## x ## _map_resource_dync
@@ -61,6 +62,7 @@
 #define xSYM_INIT_MONS(x)     plugin_ ## x ## _init_monitors
 #define xSYM_START_MONS(x)    plugin_ ## x ## _start_monitors
 #define SYM_GET_APIV(x)       xSYM_GET_APIV(x)
+#define SYM_GET_FLAGS(x)      xSYM_GET_FLAGS(x)
 #define SYM_LOAD_CONFIG(x)    xSYM_LOAD_CONFIG(x)
 #define SYM_MAP_RESOURCEA(x)  xSYM_MAP_RESOURCEA(x)
 #define SYM_MAP_RESOURCEC(x)  xSYM_MAP_RESOURCEC(x)
@@ -80,6 +82,7 @@ F_CONST
 unsigned SYM_GET_APIV(GDNSD_PLUGIN_NAME)(void);
 unsigned SYM_GET_APIV(GDNSD_PLUGIN_NAME)(void) { return GDNSD_PLUGIN_API_VERSION; }
 
+unsigned SYM_GET_FLAGS(GDNSD_PLUGIN_NAME)(void);
 monio_list_t* SYM_LOAD_CONFIG(GDNSD_PLUGIN_NAME)(const vscf_data_t* config);
 unsigned SYM_MAP_RESOURCEA(GDNSD_PLUGIN_NAME)(const char* resname);
 unsigned SYM_MAP_RESOURCEC(GDNSD_PLUGIN_NAME)(const char* resname, const uint8_t* origin);
@@ -103,6 +106,7 @@ F_NONNULL
 void SYM_START_MONS(GDNSD_PLUGIN_NAME)(struct ev_loop* mon_loop);
 
 #undef SYM_APIV
+#undef SYM_GET_FLAGS
 #undef SYM_LOAD_CONFIG
 #undef SYM_MAP_RESOURCE
 #undef SYM_MAP_RESOURCEA
@@ -119,6 +123,7 @@ void SYM_START_MONS(GDNSD_PLUGIN_NAME)(struct ev_loop* mon_loop);
 #undef SYM_INIT_MONS
 #undef SYM_START_MONS
 #undef xSYM_APIV
+#undef xSYM_GET_FLAGS
 #undef xSYM_LOAD_CONFIG
 #undef xSYM_MAP_RESOURCE
 #undef xSYM_MAP_RESOURCEA
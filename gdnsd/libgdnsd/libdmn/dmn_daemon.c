@@ -139,9 +139,15 @@ static pid_t startup_pidrace(const char* pidfile, const bool restart) {
                 return pid;
             if(old_pid)
                 kill(old_pid, SIGTERM);
-            tv.tv_sec = 0;
-            tv.tv_usec = 100000 * tries;
-            select(0, NULL, NULL, NULL, &tv);
+            // Wait up to 100ms * tries, but check every 10ms so that we
+            //  take over promptly once the old instance exits
+            for(unsigned waited = 0; waited < (10 * tries); waited++) {
+                tv.tv_sec = 0;
+                tv.tv_usec = 10000;
+                select(0, NULL, NULL, NULL, &tv);
+                if(!check_pidfile(pidfile))
+                    break;
+            }
         }
         dmn_log_fatal("restart: failed, cannot shut down previous instance and acquire pidfile lock");
     }
@@ -20,6 +20,7 @@
 #include "config.h"
 
 #include "gdnsd-monio.h"
+#include "gdnsd-plugapi.h"
 #include "gdnsd-log.h"
 
 /*
@@ -44,6 +45,16 @@ state_updater {
 }
 */
 
+// Sets all of the states tracking "smgr", and invalidates any
+//  cached plugin results which may have depended on them
+F_NONNULL
+static void smgr_set_state(monio_smgr_t* smgr, const monio_state_uint_t state) {
+    dmn_assert(smgr);
+    for(unsigned i = 0; i < smgr->num_state_ptrs; i++)
+        monio_state_set(smgr->monio_state_ptrs[i], state);
+    gdnsd_plugins_results_changed();
+}
+
 void gdnsd_monio_state_updater(monio_smgr_t* smgr, const bool latest) {
     dmn_assert(smgr);
 
@@ -56,21 +67,18 @@ void gdnsd_monio_state_updater(monio_smgr_t* smgr, const bool latest) {
             case MONIO_STATE_DANGER:
                 if(++(smgr->n_success) == smgr->ok_thresh) {
                     log_info("'%s' transitioned to the UP state", smgr->desc);
-                    for(unsigned i = 0; i < smgr->num_state_ptrs; i++)
-                        monio_state_set(smgr->monio_state_ptrs[i], MONIO_STATE_UP);
+                    smgr_set_state(smgr, MONIO_STATE_UP);
                 }
                 break;
             case MONIO_STATE_DOWN:
                 if(++(smgr->n_success) == smgr->up_thresh) {
                     log_info("'%s' transitioned to the UP state", smgr->desc);
-                    for(unsigned i = 0; i < smgr->num_state_ptrs; i++)
-                        monio_state_set(smgr->monio_state_ptrs[i], MONIO_STATE_UP);
+                    smgr_set_state(smgr, MONIO_STATE_UP);
                 }
                 break;
             case MONIO_STATE_UNINIT:
                 log_info("'%s' initialized to the UP state", smgr->desc);
-                for(unsigned i = 0; i < smgr->num_state_ptrs; i++)
-                    monio_state_set(smgr->monio_state_ptrs[i], MONIO_STATE_UP);
+                smgr_set_state(smgr, MONIO_STATE_UP);
                 break;
         }
     }
@@ -80,22 +88,19 @@ void gdnsd_monio_state_updater(monio_smgr_t* smgr, const bool latest) {
             case MONIO_STATE_UP:
                 smgr->n_failure = 1;
                 log_info("'%s' transitioned to the DANGER state", smgr->desc);
-                for(unsigned i = 0; i < smgr->num_state_ptrs; i++)
-                    monio_state_set(smgr->monio_state_ptrs[i], MONIO_STATE_DANGER);
+                smgr_set_state(smgr, MONIO_STATE_DANGER);
                 break;
             case MONIO_STATE_DANGER:
                 if(++(smgr->n_failure) == smgr->down_thresh) {
                      log_info("'%s' transitioned to the DOWN state", smgr->desc);
-                    for(unsigned i = 0; i < smgr->num_state_ptrs; i++)
-                        monio_state_set(smgr->monio_state_ptrs[i], MONIO_STATE_DOWN);
+                    smgr_set_state(smgr, MONIO_STATE_DOWN);
                 }
                 break;
             case MONIO_STATE_DOWN:
                 break;
             case MONIO_STATE_UNINIT:
                 log_info("'%s' initialized to the DOWN state", smgr->desc);
-                for(unsigned i = 0; i < smgr->num_state_ptrs; i++)
-                    monio_state_set(smgr->monio_state_ptrs[i], MONIO_STATE_DOWN);
+                smgr_set_state(smgr, MONIO_STATE_DOWN);
                 break;
         }
     }
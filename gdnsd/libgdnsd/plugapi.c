@@ -157,6 +157,7 @@ const plugin_t* gdnsd_plugin_load(const char* pname) {
             pname, GDNSD_PLUGIN_API_VERSION, this_version);
 
 #   define _PSETFUNC(x) plug->x = (gdnsd_ ## x ## _cb_t)plugin_dlsym(pptr, pname, #x);
+    _PSETFUNC(get_flags)
     _PSETFUNC(load_config)
     _PSETFUNC(map_resource_dyna)
     _PSETFUNC(map_resource_dync)
@@ -226,3 +227,18 @@ void gdnsd_plugins_action_exit(void) {
             plugins[i]->exit();
 }
 
+
+// Monitoring state changes come from the main thread and database reloads
+//  from plugin threads, so unlike the satom_t stats this has several
+//  writers and needs a real atomic increment.  The release/acquire pair
+//  ensures that a reader which sees the new generation also sees the
+//  state change which preceded it.
+static uintptr_t results_gen = 0;
+
+void gdnsd_plugins_results_changed(void) {
+    __atomic_add_fetch(&results_gen, 1, __ATOMIC_RELEASE);
+}
+
+uintptr_t gdnsd_plugins_results_gen(void) {
+    return __atomic_load_n(&results_gen, __ATOMIC_ACQUIRE);
+}
@@ -310,6 +310,13 @@ void ltree_add_rec_aaaa(const uint8_t* dname, const uint8_t* addr, unsigned ttl,
     }
 }
 
+// Whether dnspacket.c may cache this plugin's results (dynamic_cache_size)
+F_NONNULL
+static bool plugin_results_cacheable(const plugin_t* p) {
+    dmn_assert(p);
+    return p->get_flags && (p->get_flags() & GDNSD_PLUGIN_FLAG_CACHE_RESULTS);
+}
+
 void ltree_add_rec_dynaddr(const uint8_t* dname, const uint8_t* rhs, unsigned ttl, unsigned limit_v4, unsigned limit_v6) {
     dmn_assert(dname); dmn_assert(rhs);
 
@@ -340,6 +347,7 @@ void ltree_add_rec_dynaddr(const uint8_t* dname, const uint8_t* rhs, unsigned tt
         else {                
             rrset->a.dyn.resource = p->map_resource_dyna ? p->map_resource_dyna(resource_name) : 0;
             rrset->a.dyn.func = p->resolve_dynaddr;
+            rrset->a.dyn.cacheable = plugin_results_cacheable(p);
             free(plugin_name);
         }
         return;
@@ -401,6 +409,7 @@ void ltree_add_rec_dyncname(const uint8_t* dname, const uint8_t* rhs, const uint
             //  (which he probably shouldn't, but can't hurt to make life easier)
             rrset->c.dyn.resource = p->map_resource_dync ? p->map_resource_dync(resource_name, rrset->c.dyn.origin) : 0;
             rrset->c.dyn.func = p->resolve_dyncname;
+            rrset->c.dyn.cacheable = plugin_results_cacheable(p);
             free(plugin_name);
             return;
         }
@@ -1057,6 +1066,32 @@ static void ltree_proc_phase2(const uint8_t** lstack, ltree_node_t* node, const
         ooz_check_glue(node);
 }
 
+// Count of responses pre-encoded by phase3 below
+static unsigned preencoded_count = 0;
+
+// preencode_answers: pre-encodes the static responses at each node, see
+//  dnspacket_preencode_node().  lstack is used to reconstruct the node's name.
+F_NONNULL
+static void ltree_proc_phase3(const uint8_t** lstack, ltree_node_t* node, const ltree_node_t* zone_root V_UNUSED, const unsigned depth, const bool in_deleg) {
+    dmn_assert(node);
+
+    if(in_deleg || !(node->flags & LTNFLAG_AUTH) || !node->rrsets)
+        return;
+
+    uint8_t dname[256];
+    unsigned pos = 1;
+    for(unsigned i = depth; i; i--) {
+        const unsigned llen = *lstack[i] + 1U;
+        dmn_assert(pos + llen < 256);
+        memcpy(&dname[pos], lstack[i], llen);
+        pos += llen;
+    }
+    dname[pos] = '\0';
+    dname[0] = pos;
+
+    preencoded_count += dnspacket_preencode_node(node, dname);
+}
+
 F_NONNULLX(1, 2)
 static void _ltree_proc_inner(void (*fn)(const uint8_t**, ltree_node_t*, const ltree_node_t*, const unsigned, const bool), const uint8_t** lstack, ltree_node_t* node, const ltree_node_t* zone_root, unsigned depth, bool in_deleg) {
     dmn_assert(fn); dmn_assert(node);
@@ -1144,4 +1179,9 @@ void ltree_load_zones(void) {
     ltree_process(&ltree_proc_phase2); // Glue-related checks that depend on full
                                        //  output of phase1
 
+    if(gconfig.preencode_answers) {
+        ltree_process(&ltree_proc_phase3); // Pre-encode static responses
+        log_info("preencode_answers: pre-encoded %u static responses", preencoded_count);
+    }
+
 }
@@ -111,6 +111,10 @@ struct _ltree_rrset_rfc3597_struct;
 
 typedef struct _ltree_node_struct ltree_node_t;
 
+// Pre-encoded static responses (preencode_answers), opaque outside of dnspacket.c
+struct _ltree_tmpl_struct;
+typedef struct _ltree_tmpl_struct ltree_tmpl_t;
+
 typedef struct _ltree_rdata_ns_struct ltree_rdata_ns_t;
 typedef struct _ltree_rdata_ptr_struct ltree_rdata_ptr_t;
 typedef struct _ltree_rdata_mx_struct ltree_rdata_mx_t;
@@ -208,6 +212,7 @@ struct _ltree_rrset_addr_struct {
         struct {
             gdnsd_resolve_dynaddr_cb_t func;
             unsigned resource;
+            bool cacheable; // plugin set GDNSD_PLUGIN_FLAG_CACHE_RESULTS
         } dyn;
     } a;
     uint16_t limit_v4;
@@ -229,6 +234,7 @@ struct _ltree_rrset_cname_struct {
             uint8_t* origin;
             gdnsd_resolve_dyncname_cb_t func;
             unsigned resource;
+            bool cacheable; // plugin set GDNSD_PLUGIN_FLAG_CACHE_RESULTS
         } dyn;
     } c;
 };
@@ -325,6 +331,7 @@ struct _ltree_node_struct {
     ltree_node_t* next;         // next node in this child_table hash slot
     ltree_node_t* * child_table; // The table of children.
     ltree_rrset_t* rrsets;     // The list of rrsets
+    ltree_tmpl_t* tmpls;       // Pre-encoded responses by qtype, if preencode_answers
 };
 
 // Adding data to the ltree (called from parser)
@@ -379,7 +386,7 @@ extern ltree_node_t* ltree_root;
 // this variant is for labels encoded as one length-byte followed
 //  by N characters.  Thus the label "www" becomes "\003www" (4 bytes)
 F_PURE F_WUNUSED F_NONNULL F_UNUSED
-static inline uint32_t label_djb_hash(const uint8_t* input, const uint32_t hash_mask) {
+static inline uint32_t label_djb_hash_full(const uint8_t* input) {
    dmn_assert(input);
 
    uint32_t hash = 5381;
@@ -387,7 +394,14 @@ static inline uint32_t label_djb_hash(const uint8_t* input, const uint32_t hash_
    while(len--)
        hash = (hash * 33) ^ *input++;
 
-   return hash & hash_mask;
+   return hash;
+}
+
+// the child_table index of a label, for a table's child_hash_mask
+F_PURE F_WUNUSED F_NONNULL F_UNUSED
+static inline uint32_t label_djb_hash(const uint8_t* input, const uint32_t hash_mask) {
+   dmn_assert(input);
+   return label_djb_hash_full(input) & hash_mask;
 }
 
 #undef _RC
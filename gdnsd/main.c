@@ -42,6 +42,7 @@
 #include "dnsio_udp.h"
 #include "dnspacket.h"
 #include "statio.h"
+#include "handoff.h"
 #include "monio.h"
 #include "ltree.h"
 #include "pkterr.h"
@@ -54,6 +55,27 @@ static void syserr_for_ev(const char* msg) { dmn_assert(msg); log_fatal("%s: %s"
 
 static pthread_t* threadids = NULL;
 
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+#include <sched.h>
+
+// Pins the next thread created with attribs to a single CPU, or
+//  restores the default mask if cpu is -1.  Everything a thread
+//  allocates is first touched from its pinned CPU, so its memory
+//  lands on the local NUMA node without any explicit NUMA calls.
+F_NONNULL
+static void attr_set_cpu(pthread_attr_t* attribs, const cpu_set_t* def_mask, const int cpu) {
+    dmn_assert(attribs); dmn_assert(def_mask);
+    cpu_set_t one;
+    if(cpu >= 0) {
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+    }
+    int err = pthread_attr_setaffinity_np(attribs, sizeof(cpu_set_t), cpu >= 0 ? &one : def_mask);
+    if(err)
+        log_fatal("pthread_attr_setaffinity_np() failed for CPU %i: %s", cpu, logf_errnum(err));
+}
+#endif
+
 static void threads_cleanup(void) {
     if(threadids) {
         unsigned num_threads = gconfig.num_io_threads;
@@ -176,23 +198,37 @@ static void start_threads(void) {
     pthread_attr_setdetachstate(&attribs, PTHREAD_CREATE_JOINABLE);
     pthread_attr_setscope(&attribs, PTHREAD_SCOPE_SYSTEM);
 
-    unsigned num_addrs = gconfig.num_dns_addrs;
-    threadids = calloc(gconfig.num_io_threads, sizeof(pthread_t));
+    const unsigned num_threads = gconfig.num_io_threads;
+    threadids = calloc(num_threads, sizeof(pthread_t));
 
-    // Start UDP threads
-    for(uintptr_t i = 0; i < num_addrs; i++) {
-        const dns_addr_t* addrconf = &gconfig.dns_addrs[i];
-        int pthread_err = pthread_create(&threadids[addrconf->udp_threadnum], &attribs, &dnsio_udp_start, (void*)addrconf);
-        if(pthread_err) log_fatal("pthread_create() of UDP DNS thread failed: %s", logf_errnum(pthread_err));
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+    cpu_set_t def_mask;
+    if(sched_getaffinity(0, sizeof(def_mask), &def_mask))
+        log_fatal("sched_getaffinity() failed: %s", logf_errno());
+#endif
+
+    // Start UDP pool workers, if configured
+    const unsigned udp_pool = gconfig.udp_pool_threads;
+    for(unsigned i = 0; i < udp_pool; i++) {
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+        if(gconfig.num_thread_cpus)
+            attr_set_cpu(&attribs, &def_mask, (int)gconfig.thread_cpus[i % gconfig.num_thread_cpus]);
+#endif
+        int pthread_err = pthread_create(&threadids[i], &attribs, &dnsio_udp_pool_start, (void*)(uintptr_t)i);
+        if(pthread_err) log_fatal("pthread_create() of UDP pool thread failed: %s", logf_errnum(pthread_err));
     }
 
-    // Start TCP threads
-    for(uintptr_t i = 0; i < num_addrs; i++) {
-        const dns_addr_t* addrconf = &gconfig.dns_addrs[i];
-        if(!addrconf->tcp_disabled) {
-            int pthread_err = pthread_create(&threadids[addrconf->tcp_threadnum], &attribs, &dnsio_tcp_start, (void*)addrconf);
-            if(pthread_err) log_fatal("pthread_create() of TCP DNS thread failed: %s", logf_errnum(pthread_err));
-        }
+    // Start UDP and TCP threads
+    const unsigned num_socks = gconfig.num_dns_threads;
+    for(unsigned i = 0; i < num_socks; i++) {
+        const dns_thread_t* t = &gconfig.dns_threads[i];
+        if(t->is_udp && udp_pool)
+            continue;
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+        attr_set_cpu(&attribs, &def_mask, t->cpu);
+#endif
+        int pthread_err = pthread_create(&threadids[t->threadnum], &attribs, t->is_udp ? &dnsio_udp_start : &dnsio_tcp_start, (void*)t);
+        if(pthread_err) log_fatal("pthread_create() of %s DNS thread failed: %s", t->is_udp ? "UDP" : "TCP", logf_errnum(pthread_err));
     }
 
     // Invoke thread cleanup handlers at exit time
@@ -413,6 +449,12 @@ int main(int argc, char** argv) {
     // Ping the pthreads implementation...
     ping_pthreads();
 
+    // With restart_handoff, take over the running daemon's listening
+    //  sockets before dmn_daemonize() below stops it, so that requests
+    //  arriving in the meantime queue up for us instead of being refused
+    if(action == ACT_RESTART && gconfig.restart_handoff)
+        handoff_receive();
+
     // Daemonize if applicable
     if(action != ACT_STARTFG) {
         // so that the daemonization fork+exit pairs don't
@@ -447,6 +489,10 @@ int main(int argc, char** argv) {
     // Initialize DNS listening sockets
     const bool need_caps = dns_lsock_init();
 
+    // Offer our listening sockets to a future restart
+    if(gconfig.restart_handoff && action != ACT_STARTFG)
+        handoff_listen_init();
+
     // init the stats summing/output code
     statio_init();
 
@@ -529,6 +575,7 @@ int main(int argc, char** argv) {
     // Note, this is down here because we depend on
     //  dnspacket_wait_stats() completion.
     statio_start(def_loop);
+    handoff_start(def_loop);
 
     // Notify the user that the listeners are up
     log_info("DNS listeners started");
@@ -0,0 +1,189 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "rrl.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "conf.h"
+
+/*
+ * The buckets live in a 2-way set-associative table: a key hashes to a
+ *  pair of adjacent entries, and if it's in neither, it replaces the
+ *  one which was used least recently.  A new or replaced entry starts
+ *  with a full bucket, so a table too small for the client population
+ *  errs towards not limiting.
+ *
+ * Balances are kept in thousandths of a response.  A bucket gains
+ *  rrl_responses_per_sec of those per elapsed millisecond, holds at
+ *  most one second's worth, and each response costs 1000.
+ */
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#  define RRL_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#  define RRL_CLOCK CLOCK_MONOTONIC
+#endif
+
+typedef struct {
+    uint32_t tag;      // upper hash bits of the key, zero for an unused entry
+    uint32_t stamp_ms; // last time this entry was charged
+    int32_t  balance;  // in thousandths of a response
+    uint32_t limited;  // responses limited so far, for rrl_slip
+} rrl_entry_t;
+
+struct _rrl_table_t {
+    rrl_entry_t* entries;
+    uint64_t seed;
+    unsigned mask;     // entries - 1, with the low bit clear (pair index)
+    unsigned rate;     // rrl_responses_per_sec
+    unsigned slip;     // rrl_slip
+    int32_t  burst;    // rate * 1000
+    uint32_t v4_mask;  // network byte order
+    uint64_t v6_mask[2];
+};
+
+F_CONST
+static inline uint64_t rrl_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint32_t rrl_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(RRL_CLOCK, &ts);
+    return (uint32_t)(((uint64_t)ts.tv_sec * 1000U) + ((uint64_t)ts.tv_nsec / 1000000U));
+}
+
+rrl_table_t* rrl_table_new(gdnsd_rstate_t* rs) {
+    dmn_assert(rs);
+    dmn_assert(gconfig.rrl_responses_per_sec);
+
+    rrl_table_t* t = calloc(1, sizeof(rrl_table_t));
+
+    unsigned size = 2;
+    while(size < gconfig.rrl_table_size)
+        size <<= 1;
+    t->entries = calloc(size, sizeof(rrl_entry_t));
+    t->mask = (size - 1) & ~1U;
+    t->seed = gdnsd_rand_get64(rs);
+    t->rate = gconfig.rrl_responses_per_sec;
+    t->slip = gconfig.rrl_slip;
+    t->burst = (int32_t)(t->rate * 1000U);
+
+    const unsigned v4_bits = gconfig.rrl_ipv4_prefix_len;
+    t->v4_mask = htonl(v4_bits ? (0xFFFFFFFFU << (32 - v4_bits)) : 0);
+
+    const unsigned v6_bits = gconfig.rrl_ipv6_prefix_len;
+    uint8_t v6_mask[16];
+    for(unsigned i = 0; i < 16; i++) {
+        const unsigned bits = v6_bits > (i * 8) ? v6_bits - (i * 8) : 0;
+        v6_mask[i] = bits >= 8 ? 0xFF : (uint8_t)(0xFF00U >> bits);
+    }
+    memcpy(t->v6_mask, v6_mask, sizeof(v6_mask));
+
+    return t;
+}
+
+F_NONNULLX(1, 2)
+static uint64_t rrl_hash(const rrl_table_t* t, const anysin_t* asin, const rrl_class_t cls, const uint8_t* lqname, const unsigned qtype) {
+    dmn_assert(t); dmn_assert(asin);
+
+    uint64_t h = t->seed ^ ((uint64_t)cls << 32);
+    if(asin->sa.sa_family == AF_INET6) {
+        uint64_t a[2];
+        memcpy(a, asin->sin6.sin6_addr.s6_addr, sizeof(a));
+        h = rrl_mix(h ^ (a[0] & t->v6_mask[0]));
+        h = rrl_mix(h ^ (a[1] & t->v6_mask[1]) ^ 6U);
+    }
+    else {
+        dmn_assert(asin->sa.sa_family == AF_INET);
+        h = rrl_mix(h ^ (asin->sin.sin_addr.s_addr & t->v4_mask));
+    }
+
+    if(cls == RRL_CLASS_ANSWER || cls == RRL_CLASS_NODATA) {
+        dmn_assert(lqname);
+        h ^= qtype;
+        const unsigned len = (unsigned)*lqname + 1U;
+        unsigned i = 0;
+        for(; i + 8 <= len; i += 8) {
+            uint64_t w;
+            memcpy(&w, &lqname[i], 8);
+            h = rrl_mix(h ^ w);
+        }
+        uint64_t w = 0;
+        memcpy(&w, &lqname[i], len - i);
+        h = rrl_mix(h ^ w);
+    }
+
+    return h;
+}
+
+rrl_action_t rrl_check(rrl_table_t* t, const anysin_t* asin, const rrl_class_t cls, const uint8_t* lqname, const unsigned qtype) {
+    dmn_assert(t); dmn_assert(asin);
+
+    const uint64_t h = rrl_hash(t, asin, cls, lqname, qtype);
+    const uint32_t tag = (uint32_t)(h >> 32) | 1U;
+    rrl_entry_t* pair = &t->entries[(unsigned)h & t->mask];
+    const uint32_t now = rrl_now_ms();
+
+    rrl_entry_t* e;
+    if(pair[0].tag == tag) {
+        e = &pair[0];
+    }
+    else if(pair[1].tag == tag) {
+        e = &pair[1];
+    }
+    else {
+        e = ((now - pair[0].stamp_ms) >= (now - pair[1].stamp_ms)) ? &pair[0] : &pair[1];
+        e->tag = tag;
+        e->stamp_ms = now;
+        e->balance = t->burst;
+        e->limited = 0;
+    }
+
+    const uint32_t elapsed = now - e->stamp_ms;
+    if(elapsed) {
+        e->stamp_ms = now;
+        // balance is never below -burst, so 2s of credit always refills it
+        const int64_t credit = (int64_t)(elapsed < 2000U ? elapsed : 2000U) * t->rate;
+        const int64_t balance = (int64_t)e->balance + credit;
+        e->balance = balance > t->burst ? t->burst : (int32_t)balance;
+    }
+
+    if(likely(e->balance >= 1000)) {
+        e->balance -= 1000;
+        e->limited = 0;
+        return RRL_SEND;
+    }
+
+    // Keep accruing debt (bounded at one second's worth) while
+    //  the client keeps asking, so a steady flood stays limited
+    if(e->balance > -t->burst)
+        e->balance -= 1000;
+
+    if(t->slip && !(++e->limited % t->slip))
+        return RRL_SLIP;
+    return RRL_DROP;
+}
@@ -0,0 +1,61 @@
+/* Copyright © 2012 Brandon L Black <blblack@gmail.com>
+ *
+ * This file is part of gdnsd.
+ *
+ * gdnsd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gdnsd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gdnsd.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _GDNSD_RRL_H
+#define _GDNSD_RRL_H
+
+#include "config.h"
+#include "gdnsd.h"
+#include "gdnsd-misc.h"
+
+// Response Rate Limiting for UDP responses (rrl_responses_per_sec).
+// Each UDP I/O thread owns one table of token buckets, keyed by the
+//  client's network prefix and the class of the response (and for
+//  positive and NODATA answers, the query name and type), so no
+//  locking is involved.
+
+typedef enum {
+    RRL_CLASS_ANSWER = 0, // NOERROR with answer records
+    RRL_CLASS_NODATA,     // NOERROR without answers (incl. TC for size)
+    RRL_CLASS_REFERRAL,   // NOERROR delegation to a child zone
+    RRL_CLASS_NXDOMAIN,
+    RRL_CLASS_ERROR,      // REFUSED, FORMERR, BADVERS
+} rrl_class_t;
+
+typedef enum {
+    RRL_SEND = 0, // within the limit, send the response as normal
+    RRL_DROP,     // over the limit, send nothing
+    RRL_SLIP,     // over the limit, send a truncated (TC) response instead
+} rrl_action_t;
+
+typedef struct _rrl_table_t rrl_table_t;
+
+// Called by each UDP I/O thread when rrl_responses_per_sec is set,
+//  rs provides the per-thread hash seed
+F_NONNULL F_MALLOC F_WUNUSED
+rrl_table_t* rrl_table_new(gdnsd_rstate_t* rs);
+
+// Debits one response of class "cls" to "asin"'s bucket and returns
+//  what to do with it.  "lqname" (the query name, in the length-prefixed
+//  form dnspacket.c uses) and "qtype" are only used for
+//  RRL_CLASS_ANSWER and RRL_CLASS_NODATA, and lqname may be NULL otherwise.
+F_NONNULLX(1, 2)
+rrl_action_t rrl_check(rrl_table_t* t, const anysin_t* asin, const rrl_class_t cls, const uint8_t* lqname, const unsigned qtype);
+
+#endif // _GDNSD_RRL_H
@@ -24,6 +24,12 @@
 #include <time.h>
 #include <string.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
+
+#if defined __linux__ && defined SO_MEMINFO
+#include <linux/sock_diag.h>
+#define HAVE_SOCK_MEMINFO 1
+#endif
 
 #include "conf.h"
 #include "dnsio_udp.h"
@@ -41,9 +47,27 @@ typedef struct {
     satom_uint_t udp_tc;
     satom_uint_t udp_edns_big;
     satom_uint_t udp_edns_tc;
+    satom_uint_t udp_recv_width;
+    satom_uint_t udp_batch[UDP_BATCH_BUCKETS];
+    satom_uint_t udp_busy_spin;
+    satom_uint_t udp_busy_sleep;
+    satom_uint_t udp_rcvbuf_drops;
+    satom_uint_t udp_rcvq_bytes;
+    satom_uint_t udp_latency[UDP_LAT_BUCKETS];
+    satom_uint_t udp_lat_p50_us;
+    satom_uint_t udp_lat_p99_us;
+    satom_uint_t udp_lat_p999_us;
+    satom_uint_t rrl_drop;
+    satom_uint_t rrl_slip;
+    satom_uint_t udp_junk;
+    satom_uint_t rcache_hit;
+    satom_uint_t rcache_miss;
+    satom_uint_t dyncache_hit;
+    satom_uint_t dyncache_miss;
     satom_uint_t tcp_recvfail;
     satom_uint_t tcp_recvsize;
     satom_uint_t tcp_sendfail;
+    satom_uint_t tcp_evicted;
     satom_uint_t dns_noerror;
     satom_uint_t dns_refused;
     satom_uint_t dns_nxdomain;
@@ -94,8 +118,24 @@ static const char log_dns[] =
     "noerror:%" PRIuPTR " refused:%" PRIuPTR " nxdomain:%" PRIuPTR " notimp:%" PRIuPTR " badvers:%" PRIuPTR " formerr:%" PRIuPTR " dropped:%" PRIuPTR " v6:%" PRIuPTR " edns:%" PRIuPTR " edns_clientsub:%" PRIuPTR;
 static const char log_udp[] =
     "udp_reqs:%" PRIuPTR " udp_recvfail:%" PRIuPTR " udp_sendfail:%" PRIuPTR " udp_tc:%" PRIuPTR " udp_edns_big:%" PRIuPTR " udp_edns_tc:%" PRIuPTR;
+static const char log_udp_batch[] =
+    "udp_recv_width:%" PRIuPTR " udp_batch_1:%" PRIuPTR " udp_batch_2:%" PRIuPTR " udp_batch_4:%" PRIuPTR " udp_batch_8:%" PRIuPTR " udp_batch_16:%" PRIuPTR " udp_batch_32:%" PRIuPTR " udp_batch_64:%" PRIuPTR;
+static const char log_udp_busy[] =
+    "udp_busy_spin:%" PRIuPTR " udp_busy_sleep:%" PRIuPTR;
+static const char log_udp_rcvbuf[] =
+    "udp_rcvbuf_drops:%" PRIuPTR " udp_rcvq_bytes:%" PRIuPTR;
+static const char log_udp_lat[] =
+    "udp_lat_p50_us:%" PRIuPTR " udp_lat_p99_us:%" PRIuPTR " udp_lat_p999_us:%" PRIuPTR;
+static const char log_rrl[] =
+    "rrl_drop:%" PRIuPTR " rrl_slip:%" PRIuPTR;
+static const char log_udp_junk[] =
+    "udp_junk:%" PRIuPTR;
+static const char log_rcache[] =
+    "rcache_hit:%" PRIuPTR " rcache_miss:%" PRIuPTR;
+static const char log_dyncache[] =
+    "dyncache_hit:%" PRIuPTR " dyncache_miss:%" PRIuPTR;
 static const char log_tcp[] =
-    "tcp_reqs:%" PRIuPTR " tcp_recvfail:%" PRIuPTR " tcp_recvsize:%" PRIuPTR " tcp_sendfail:%" PRIuPTR;
+    "tcp_reqs:%" PRIuPTR " tcp_recvfail:%" PRIuPTR " tcp_recvsize:%" PRIuPTR " tcp_sendfail:%" PRIuPTR " tcp_evicted:%" PRIuPTR;
 
 static const char http_404_hdr[] =
     "HTTP/1.0 404 Not Found\r\n"
@@ -122,8 +162,24 @@ static const char csv_fixed[] =
     "%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR "\r\n"
     "udp_reqs,udp_recvfail,udp_sendfail,udp_tc,udp_edns_big,udp_edns_tc\r\n"
     "%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR "\r\n"
-    "tcp_reqs,tcp_recvfail,tcp_recvsize,tcp_sendfail\r\n"
-    "%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR "\r\n";
+    "tcp_reqs,tcp_recvfail,tcp_recvsize,tcp_sendfail,tcp_evicted\r\n"
+    "%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR "\r\n"
+    "udp_recv_width,udp_batch_1,udp_batch_2,udp_batch_4,udp_batch_8,udp_batch_16,udp_batch_32,udp_batch_64\r\n"
+    "%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR "\r\n"
+    "udp_busy_spin,udp_busy_sleep\r\n"
+    "%" PRIuPTR ",%" PRIuPTR "\r\n"
+    "udp_rcvbuf_drops,udp_rcvq_bytes\r\n"
+    "%" PRIuPTR ",%" PRIuPTR "\r\n"
+    "udp_lat_p50_us,udp_lat_p99_us,udp_lat_p999_us\r\n"
+    "%" PRIuPTR ",%" PRIuPTR ",%" PRIuPTR "\r\n"
+    "rrl_drop,rrl_slip\r\n"
+    "%" PRIuPTR ",%" PRIuPTR "\r\n"
+    "udp_junk\r\n"
+    "%" PRIuPTR "\r\n"
+    "rcache_hit,rcache_miss\r\n"
+    "%" PRIuPTR ",%" PRIuPTR "\r\n"
+    "dyncache_hit,dyncache_miss\r\n"
+    "%" PRIuPTR ",%" PRIuPTR "\r\n";
 
 static const char html_fixed[] =
     "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"
@@ -149,8 +205,32 @@ static const char html_fixed[] =
     "<tr><th>udp_reqs</th><th>udp_recvfail</th><th>udp_sendfail</th><th>udp_tc</th><th>udp_edns_big</th><th>udp_edns_tc</th></tr>\r\n"
     "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
     "</table><table>\r\n"
-    "<tr><th>tcp_reqs</th><th>tcp_recvfail</th><th>tcp_recvsize</th><th>tcp_sendfail</th></tr>\r\n"
-    "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
+    "<tr><th>tcp_reqs</th><th>tcp_recvfail</th><th>tcp_recvsize</th><th>tcp_sendfail</th><th>tcp_evicted</th></tr>\r\n"
+    "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
+    "</table><table>\r\n"
+    "<tr><th>udp_recv_width</th><th>udp_batch_1</th><th>udp_batch_2</th><th>udp_batch_4</th><th>udp_batch_8</th><th>udp_batch_16</th><th>udp_batch_32</th><th>udp_batch_64</th></tr>\r\n"
+    "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
+    "</table><table>\r\n"
+    "<tr><th>udp_busy_spin</th><th>udp_busy_sleep</th></tr>\r\n"
+    "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
+    "</table><table>\r\n"
+    "<tr><th>udp_rcvbuf_drops</th><th>udp_rcvq_bytes</th></tr>\r\n"
+    "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
+    "</table><table>\r\n"
+    "<tr><th>udp_lat_p50_us</th><th>udp_lat_p99_us</th><th>udp_lat_p999_us</th></tr>\r\n"
+    "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
+    "</table><table>\r\n"
+    "<tr><th>rrl_drop</th><th>rrl_slip</th></tr>\r\n"
+    "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
+    "</table><table>\r\n"
+    "<tr><th>udp_junk</th></tr>\r\n"
+    "<tr><td>%" PRIuPTR "</td></tr>\r\n"
+    "</table><table>\r\n"
+    "<tr><th>rcache_hit</th><th>rcache_miss</th></tr>\r\n"
+    "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
+    "</table><table>\r\n"
+    "<tr><th>dyncache_hit</th><th>dyncache_miss</th></tr>\r\n"
+    "<tr><td>%" PRIuPTR "</td><td>%" PRIuPTR "</td></tr>\r\n"
     "</table>\r\n";
 
 static const char html_footer[] =
@@ -197,17 +277,191 @@ static void accumulate_stats(unsigned threadnum) {
         stats.udp_tc       += satom_get(&this_stats->p.udp.tc);
         stats.udp_edns_big += satom_get(&this_stats->p.udp.edns_big);
         stats.udp_edns_tc  += satom_get(&this_stats->p.udp.edns_tc);
+        stats.udp_recv_width += satom_get(&this_stats->p.udp.recv_width);
+        for(unsigned i = 0; i < UDP_BATCH_BUCKETS; i++)
+            stats.udp_batch[i] += satom_get(&this_stats->p.udp.batch[i]);
+        stats.udp_busy_spin  += satom_get(&this_stats->p.udp.busy_spin);
+        stats.udp_busy_sleep += satom_get(&this_stats->p.udp.busy_sleep);
+        for(unsigned i = 0; i < UDP_LAT_BUCKETS; i++)
+            stats.udp_latency[i] += satom_get(&this_stats->p.udp.latency[i]);
+        stats.rrl_drop += satom_get(&this_stats->p.udp.rrl_drop);
+        stats.rrl_slip += satom_get(&this_stats->p.udp.rrl_slip);
+        stats.udp_junk += satom_get(&this_stats->p.udp.junk);
     }
     else {
         stats.tcp_reqs     += this_reqs;
         stats.tcp_recvfail += satom_get(&this_stats->p.tcp.recvfail);
         stats.tcp_recvsize += satom_get(&this_stats->p.tcp.recvsize);
         stats.tcp_sendfail += satom_get(&this_stats->p.tcp.sendfail);
+        stats.tcp_evicted  += satom_get(&this_stats->p.tcp.evicted);
     }
 
     stats.dns_v6             += satom_get(&this_stats->v6);
     stats.dns_edns           += satom_get(&this_stats->edns);
     stats.dns_edns_clientsub += satom_get(&this_stats->edns_clientsub);
+    stats.rcache_hit         += satom_get(&this_stats->rcache_hit);
+    stats.rcache_miss        += satom_get(&this_stats->rcache_miss);
+    stats.dyncache_hit       += satom_get(&this_stats->dyncache_hit);
+    stats.dyncache_miss      += satom_get(&this_stats->dyncache_miss);
+}
+
+// Size reserved for the per-socket rows in each output buffer
+static unsigned udp_sock_stats_len = 0;
+
+#ifdef HAVE_SOCK_MEMINFO
+
+// The kernel's count of datagrams dropped for lack of receive buffer
+//  space, and the bytes currently queued, for one UDP socket
+F_NONNULL
+static bool udp_sock_meminfo(const int sock, uint32_t* drops, uint32_t* qbytes) {
+    dmn_assert(drops); dmn_assert(qbytes);
+    uint32_t mi[SK_MEMINFO_VARS];
+    socklen_t mi_len = sizeof(mi);
+    if(getsockopt(sock, SOL_SOCKET, SO_MEMINFO, mi, &mi_len)
+        || mi_len < (SK_MEMINFO_DROPS + 1) * sizeof(uint32_t))
+        return false;
+    *drops = mi[SK_MEMINFO_DROPS];
+    *qbytes = mi[SK_MEMINFO_RMEM_ALLOC];
+    return true;
+}
+
+static void accumulate_udp_sock_stats(void) {
+    const unsigned nsocks = gconfig.num_dns_threads;
+    for(unsigned i = 0; i < nsocks; i++) {
+        const dns_thread_t* t = &gconfig.dns_threads[i];
+        uint32_t drops, qbytes;
+        if(t->is_udp && udp_sock_meminfo(t->sock, &drops, &qbytes)) {
+            stats.udp_rcvbuf_drops += drops;
+            stats.udp_rcvq_bytes += qbytes;
+        }
+    }
+}
+
+// Drop counts as of the previous log_udp_sock_drops(), per dns_threads entry
+static uint32_t* logged_sock_drops = NULL;
+
+// Logs each UDP socket which has dropped requests since the last call,
+//  to show which listeners need more threads or a larger udp_rcvbuf
+static void log_udp_sock_drops(void) {
+    const unsigned nsocks = gconfig.num_dns_threads;
+    if(!logged_sock_drops)
+        logged_sock_drops = calloc(nsocks, sizeof(uint32_t));
+    for(unsigned i = 0; i < nsocks; i++) {
+        const dns_thread_t* t = &gconfig.dns_threads[i];
+        uint32_t drops, qbytes;
+        if(t->is_udp && udp_sock_meminfo(t->sock, &drops, &qbytes)) {
+            if(drops != logged_sock_drops[i])
+                log_info("UDP socket %s (thread %u): %u receive buffer drops since last report, %u bytes queued",
+                    logf_anysin(&t->ac->addr), t->threadnum, drops - logged_sock_drops[i], qbytes);
+            logged_sock_drops[i] = drops;
+        }
+    }
+}
+
+// Per-socket output, after the fixed stats and before monio's.  Both
+//  row templates take the socket address, thread, drops, and bytes queued.
+static const char csv_sock_head[] = "UDPSocket,Thread,RcvbufDrops,RcvqBytes\r\n";
+static const char csv_sock_tmpl[] = "%s,%u,%" PRIu32 ",%" PRIu32 "\r\n";
+static const char csv_sock_foot[] = "";
+
+static const char html_sock_head[] = "<p><span class='bold big'>UDP Socket Receive Buffers:</span></p><table>\r\n"
+    "<tr><th>Socket</th><th>Thread</th><th>rcvbuf_drops</th><th>rcvq_bytes</th></tr>\r\n";
+static const char html_sock_tmpl[] = "<tr><td>%s</td><td>%u</td><td>%" PRIu32 "</td><td>%" PRIu32 "</td></tr>\r\n";
+static const char html_sock_foot[] = "</table>\r\n";
+
+// "[" + address + "]:" + port
+#define SOCK_ADDR_MAXLEN (INET6_ADDRSTRLEN + 8)
+
+static unsigned udp_sock_stats_max_len(void) {
+    unsigned nsocks = 0;
+    for(unsigned i = 0; i < gconfig.num_dns_threads; i++)
+        if(gconfig.dns_threads[i].is_udp)
+            nsocks++;
+    if(!nsocks)
+        return 0;
+
+    // html is always the larger of the two
+    return (sizeof(html_sock_head) - 1) + (sizeof(html_sock_foot) - 1)
+        + nsocks * ((sizeof(html_sock_tmpl) - 1) + SOCK_ADDR_MAXLEN + (3 * 10));
+}
+
+F_NONNULL
+static unsigned udp_sock_stats_out(char* buf, const unsigned avail, const char* head, const char* tmpl, const char* foot) {
+    dmn_assert(buf); dmn_assert(head); dmn_assert(tmpl); dmn_assert(foot);
+
+    if(!avail) return 0;
+
+    const unsigned head_len = strlen(head);
+    const unsigned foot_len = strlen(foot);
+    const char* const buf_start = buf;
+    unsigned left = avail;
+
+    memcpy(buf, head, head_len);
+    buf += head_len;
+    left -= head_len;
+
+    for(unsigned i = 0; i < gconfig.num_dns_threads; i++) {
+        const dns_thread_t* t = &gconfig.dns_threads[i];
+        uint32_t drops, qbytes;
+        if(!t->is_udp)
+            continue;
+        if(!udp_sock_meminfo(t->sock, &drops, &qbytes))
+            drops = qbytes = 0;
+        const int written = snprintf(buf, left, tmpl, logf_anysin(&t->ac->addr), t->threadnum, drops, qbytes);
+        dmn_fmtbuf_reset();
+        if(unlikely(written < 0 || (unsigned)written >= left || left - written < foot_len))
+            log_fatal("BUG: UDP socket stats buf miscalculated");
+        buf += written;
+        left -= written;
+    }
+
+    memcpy(buf, foot, foot_len);
+    buf += foot_len;
+
+    return (buf - buf_start);
+}
+
+F_NONNULL
+static unsigned udp_sock_stats_out_csv(char* buf) {
+    return udp_sock_stats_out(buf, udp_sock_stats_len, csv_sock_head, csv_sock_tmpl, csv_sock_foot);
+}
+
+F_NONNULL
+static unsigned udp_sock_stats_out_html(char* buf) {
+    return udp_sock_stats_out(buf, udp_sock_stats_len, html_sock_head, html_sock_tmpl, html_sock_foot);
+}
+
+#else
+
+static void accumulate_udp_sock_stats(void) { }
+static void log_udp_sock_drops(void) { }
+static unsigned udp_sock_stats_max_len(void) { return 0; }
+static unsigned udp_sock_stats_out_csv(char* buf V_UNUSED) { return 0; }
+static unsigned udp_sock_stats_out_html(char* buf V_UNUSED) { return 0; }
+
+#endif // HAVE_SOCK_MEMINFO
+
+// Latency percentile from the merged log2 histogram, reported as the
+//  upper bound in microseconds of the bucket which reaches it
+//  (the open-ended last bucket reports its lower bound).
+static satom_uint_t udp_lat_percentile(const unsigned permille) {
+    satom_uint_t total = 0;
+    for(unsigned i = 0; i < UDP_LAT_BUCKETS; i++)
+        total += stats.udp_latency[i];
+    if(!total)
+        return 0;
+
+    const uint64_t want = (((uint64_t)total * permille) + 999U) / 1000U;
+    uint64_t seen = 0;
+    unsigned i;
+    for(i = 0; i < (UDP_LAT_BUCKETS - 1); i++) {
+        seen += stats.udp_latency[i];
+        if(seen >= want)
+            break;
+    }
+    return (i == (UDP_LAT_BUCKETS - 1))
+        ? ((satom_uint_t)1U << i)
+        : ((satom_uint_t)1U << (i + 1));
 }
 
 static void populate_stats(void) {
@@ -216,8 +470,23 @@ static void populate_stats(void) {
         memset(&stats, 0, sizeof(stats));
 
         const unsigned nio = gconfig.num_io_threads;
-        for(unsigned i = 0; i < nio; i++)
+        unsigned num_udp = 0;
+        for(unsigned i = 0; i < nio; i++) {
             accumulate_stats(i);
+            if(dnspacket_stats[i]->is_udp)
+                num_udp++;
+        }
+
+        accumulate_udp_sock_stats();
+
+        // recv_width is a per-thread gauge, so report the average
+        if(num_udp)
+            stats.udp_recv_width = (stats.udp_recv_width + (num_udp / 2)) / num_udp;
+
+        stats.udp_lat_p50_us = udp_lat_percentile(500);
+        stats.udp_lat_p99_us = udp_lat_percentile(990);
+        stats.udp_lat_p999_us = udp_lat_percentile(999);
+
         pop_stats_time = now;
     }
 }
@@ -256,7 +525,20 @@ void statio_log_stats(void) {
     populate_stats();
     log_info(log_dns, stats.dns_noerror, stats.dns_refused, stats.dns_nxdomain, stats.dns_notimp, stats.dns_badvers, stats.dns_formerr, stats.dns_dropped, stats.dns_v6, stats.dns_edns, stats.dns_edns_clientsub);
     log_info(log_udp, stats.udp_reqs, stats.udp_recvfail, stats.udp_sendfail, stats.udp_tc, stats.udp_edns_big, stats.udp_edns_tc);
-    log_info(log_tcp, stats.tcp_reqs, stats.tcp_recvfail, stats.tcp_recvsize, stats.tcp_sendfail);
+    log_info(log_tcp, stats.tcp_reqs, stats.tcp_recvfail, stats.tcp_recvsize, stats.tcp_sendfail, stats.tcp_evicted);
+    log_info(log_udp_batch, stats.udp_recv_width, stats.udp_batch[0], stats.udp_batch[1], stats.udp_batch[2], stats.udp_batch[3], stats.udp_batch[4], stats.udp_batch[5], stats.udp_batch[6]);
+    log_info(log_udp_busy, stats.udp_busy_spin, stats.udp_busy_sleep);
+    log_info(log_udp_rcvbuf, stats.udp_rcvbuf_drops, stats.udp_rcvq_bytes);
+    log_info(log_udp_junk, stats.udp_junk);
+    if(gconfig.udp_latency_stats)
+        log_info(log_udp_lat, stats.udp_lat_p50_us, stats.udp_lat_p99_us, stats.udp_lat_p999_us);
+    if(gconfig.rrl_responses_per_sec)
+        log_info(log_rrl, stats.rrl_drop, stats.rrl_slip);
+    if(gconfig.response_cache_size)
+        log_info(log_rcache, stats.rcache_hit, stats.rcache_miss);
+    if(gconfig.dynamic_cache_size)
+        log_info(log_dyncache, stats.dyncache_hit, stats.dyncache_miss);
+    log_udp_sock_drops();
 }
 
 F_NONNULL
@@ -264,8 +546,9 @@ static void statio_fill_outbuf_csv(struct iovec* outbufs) {
     dmn_assert(outbufs);
     populate_stats();
 
-    outbufs[1].iov_len = snprintf(outbufs[1].iov_base, data_buffer_size, csv_fixed, (long)(pop_stats_time - start_time), stats.dns_noerror, stats.dns_refused, stats.dns_nxdomain, stats.dns_notimp, stats.dns_badvers, stats.dns_formerr, stats.dns_dropped, stats.dns_v6, stats.dns_edns, stats.dns_edns_clientsub, stats.udp_reqs, stats.udp_recvfail, stats.udp_sendfail, stats.udp_tc, stats.udp_edns_big, stats.udp_edns_tc, stats.tcp_reqs, stats.tcp_recvfail, stats.tcp_recvsize, stats.tcp_sendfail);
+    outbufs[1].iov_len = snprintf(outbufs[1].iov_base, data_buffer_size, csv_fixed, (long)(pop_stats_time - start_time), stats.dns_noerror, stats.dns_refused, stats.dns_nxdomain, stats.dns_notimp, stats.dns_badvers, stats.dns_formerr, stats.dns_dropped, stats.dns_v6, stats.dns_edns, stats.dns_edns_clientsub, stats.udp_reqs, stats.udp_recvfail, stats.udp_sendfail, stats.udp_tc, stats.udp_edns_big, stats.udp_edns_tc, stats.tcp_reqs, stats.tcp_recvfail, stats.tcp_recvsize, stats.tcp_sendfail, stats.tcp_evicted, stats.udp_recv_width, stats.udp_batch[0], stats.udp_batch[1], stats.udp_batch[2], stats.udp_batch[3], stats.udp_batch[4], stats.udp_batch[5], stats.udp_batch[6], stats.udp_busy_spin, stats.udp_busy_sleep, stats.udp_rcvbuf_drops, stats.udp_rcvq_bytes, stats.udp_lat_p50_us, stats.udp_lat_p99_us, stats.udp_lat_p999_us, stats.rrl_drop, stats.rrl_slip, stats.udp_junk, stats.rcache_hit, stats.rcache_miss, stats.dyncache_hit, stats.dyncache_miss);
 
+    outbufs[1].iov_len += udp_sock_stats_out_csv(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
     outbufs[1].iov_len += monio_stats_out_csv(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
     outbufs[0].iov_len = snprintf(outbufs[0].iov_base, hdr_buffer_size, http_headers, "text/plain", (long)outbufs[1].iov_len);
 }
@@ -285,8 +568,9 @@ static void statio_fill_outbuf_html(struct iovec* outbufs) {
     if(!asctime_r(&now_tm, now_char))
         log_fatal("asctime_r() failed");
 
-    outbufs[1].iov_len = snprintf(outbufs[1].iov_base, data_buffer_size, html_fixed, now_char, fmt_ival(uptime), stats.dns_noerror, stats.dns_refused, stats.dns_nxdomain, stats.dns_notimp, stats.dns_badvers, stats.dns_formerr, stats.dns_dropped, stats.dns_v6, stats.dns_edns, stats.dns_edns_clientsub, stats.udp_reqs, stats.udp_recvfail, stats.udp_sendfail, stats.udp_tc, stats.udp_edns_big, stats.udp_edns_tc, stats.tcp_reqs, stats.tcp_recvfail, stats.tcp_recvsize, stats.tcp_sendfail);
+    outbufs[1].iov_len = snprintf(outbufs[1].iov_base, data_buffer_size, html_fixed, now_char, fmt_ival(uptime), stats.dns_noerror, stats.dns_refused, stats.dns_nxdomain, stats.dns_notimp, stats.dns_badvers, stats.dns_formerr, stats.dns_dropped, stats.dns_v6, stats.dns_edns, stats.dns_edns_clientsub, stats.udp_reqs, stats.udp_recvfail, stats.udp_sendfail, stats.udp_tc, stats.udp_edns_big, stats.udp_edns_tc, stats.tcp_reqs, stats.tcp_recvfail, stats.tcp_recvsize, stats.tcp_sendfail, stats.tcp_evicted, stats.udp_recv_width, stats.udp_batch[0], stats.udp_batch[1], stats.udp_batch[2], stats.udp_batch[3], stats.udp_batch[4], stats.udp_batch[5], stats.udp_batch[6], stats.udp_busy_spin, stats.udp_busy_sleep, stats.udp_rcvbuf_drops, stats.udp_rcvq_bytes, stats.udp_lat_p50_us, stats.udp_lat_p99_us, stats.udp_lat_p999_us, stats.rrl_drop, stats.rrl_slip, stats.udp_junk, stats.rcache_hit, stats.rcache_miss, stats.dyncache_hit, stats.dyncache_miss);
 
+    outbufs[1].iov_len += udp_sock_stats_out_html(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
     outbufs[1].iov_len += monio_stats_out_html(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len));
     memcpy(ADDVOID(outbufs[1].iov_base, outbufs[1].iov_len), html_footer, (sizeof(html_footer)) - 1);
     outbufs[1].iov_len += (sizeof(html_footer)-1);
@@ -559,7 +843,8 @@ void statio_init(void) {
         (sizeof(html_fixed) - 1)        // html_fixed format string
         + (25 - 2)                      // max asctime output - 2 for the original %s
         + (IVAL_BUFSZ - 2)              // max fmt_ival output, again - 2 for %s
-        + (20 * (20 - strlen(PRIuPTR))) // 20 satom stats, up to 20 bytes long each
+        + (43 * (20 - strlen(PRIuPTR))) // 43 satom stats, up to 20 bytes long each
+        + (udp_sock_stats_len = udp_sock_stats_max_len()) // per-socket rows
         + monio_get_max_stats_len()     // whatever monio tells us...
         + (sizeof(html_footer) - 1);    // html_footer fixed string
 
@@ -100,6 +100,7 @@ static const uint8_t* map_get_dclist(const unsigned mapnum, const client_info_t*
 #define PNSTR "geoip"
 #define DYNC_OK 1
 #define CB_LOAD_CONFIG plugin_geoip_load_config
+#define CB_GET_FLAGS plugin_geoip_get_flags
 #define CB_MAP_A plugin_geoip_map_resource_dyna
 #define CB_MAP_C plugin_geoip_map_resource_dync
 #define CB_RES_A plugin_geoip_resolve_dynaddr
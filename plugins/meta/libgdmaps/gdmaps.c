@@ -1406,6 +1406,9 @@ static int gdmap_reload_geoip(gdmap_t* gdmap) {
     gdmap->tree = new_tree;
     pthread_rwlock_unlock(&gdmap->tree_lock);
 
+    // Results cached by dnspacket.c (dynamic_cache_size) came from the old tree
+    gdnsd_plugins_results_changed();
+
     log_info("plugin_geoip: map '%s': (Re-)Load of GeoIP database(s) complete", gdmap->name);
 
     if(old_tree) {
@@ -421,6 +421,35 @@ unsigned CB_MAP_C(const char* resname, const uint8_t* origin) {
 }
 #endif
 
+// Our results may only be cached if those of every plugin we call may be.
+//  This is first asked while loading zones, when all plugins are configured.
+//  A nested call back into ourselves (via another meta-plugin) answers
+//  "cacheable", so that the outermost call depends only on the rest.
+unsigned CB_GET_FLAGS(void) {
+    static bool checking = false;
+    if(checking)
+        return GDNSD_PLUGIN_FLAG_CACHE_RESULTS;
+
+    checking = true;
+    unsigned flags = GDNSD_PLUGIN_FLAG_CACHE_RESULTS;
+    for(unsigned i = 0; flags && i < num_res; i++) {
+        const resource_t* res = &resources[i];
+        for(unsigned j = 1; j <= res->num_dcs; j++) {
+            const dc_t* dc = &res->dcs[j];
+            if(!dc->plugin_name) // fixed CNAME
+                continue;
+            const plugin_t* p = gdnsd_plugin_find(dc->plugin_name);
+            if(!p || !p->get_flags || !(p->get_flags() & GDNSD_PLUGIN_FLAG_CACHE_RESULTS)) {
+                flags = 0;
+                break;
+            }
+        }
+    }
+    checking = false;
+
+    return flags;
+}
+
 F_NONNULL
 bool CB_RES_A(unsigned threadnum V_UNUSED, unsigned resnum, const client_info_t* cinfo, dynaddr_result_t* result) {
     dmn_assert(cinfo); dmn_assert(result);
@@ -326,6 +326,11 @@ static bool config_res(const char* resname, unsigned resname_len V_UNUSED, const
 /* Exported callbacks start here */
 /*********************************/
 
+// Results only change along with monitored state, so they may be cached
+unsigned plugin_multifo_get_flags(void) {
+    return GDNSD_PLUGIN_FLAG_CACHE_RESULTS;
+}
+
 monio_list_t* plugin_multifo_load_config(const vscf_data_t* config) {
     if(!config)
         log_fatal("multifo plugin requires a 'plugins' configuration stanza");
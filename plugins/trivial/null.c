@@ -23,6 +23,11 @@
 #include <gdnsd-plugin.h>
 #include <string.h>
 
+// Constant results, so they may be cached
+unsigned plugin_null_get_flags(void) {
+    return GDNSD_PLUGIN_FLAG_CACHE_RESULTS;
+}
+
 bool plugin_null_resolve_dynaddr(unsigned threadnum V_UNUSED, unsigned resnum V_UNUSED, const client_info_t* cinfo V_UNUSED, dynaddr_result_t* result) {
     result->count_v4 = 1;
     result->count_v6 = 1;
@@ -66,6 +66,11 @@ static bool config_res(const char* resname, unsigned resname_len V_UNUSED, const
     return true;
 }
 
+// Constant results, so they may be cached
+unsigned plugin_static_get_flags(void) {
+    return GDNSD_PLUGIN_FLAG_CACHE_RESULTS;
+}
+
 monio_list_t* plugin_static_load_config(const vscf_data_t* config) {
     if(!config)
         log_fatal("static plugin requires a 'plugins' configuration stanza");
@@ -0,0 +1,120 @@
+
+# Test the edns-tcp-keepalive option (RFC 7828), alone and combined
+#  with edns-client-subnet in the same OPT RR.  These use raw packets,
+#  as Net::DNS can't put more than one option in an OPT RR.
+
+use _GDT ();
+use FindBin ();
+use File::Spec ();
+use Net::DNS ();
+use Socket qw/AF_INET/;
+use Socket6 qw/inet_pton/;
+use Test::More tests => 1 + (7 * 2) + 1;
+
+my $KEEPALIVE = 11;
+my $CLIENTSUB = 0x50fa;
+
+# the timeout we advertise, from tcp_timeout = 7 in gdnsd.conf
+my $keepalive_resp = [ $KEEPALIVE, pack('n', 70) ];
+
+my $clientsub_query = [ $CLIENTSUB, pack('nCCa3', 1, 24, 0, inet_pton(AF_INET, '192.0.2.0')) ];
+my $clientsub_resp  = [ $CLIENTSUB, pack('nCCa3', 1, 24, 24, inet_pton(AF_INET, '192.0.2.0')) ];
+
+my $pid = _GDT->test_spawn_daemon(File::Spec->catfile($FindBin::Bin, 'gdnsd.conf'));
+
+# Sends the query with the given EDNS options, and checks the rcode,
+#  the first answer address (if any), and the options in the response
+#  OPT RR, in order.
+sub test_keepalive {
+    my %args = @_;
+    local $Test::Builder::Level = $Test::Builder::Level + 1;
+
+    _GDT->stats_inc(@{$args{stats}});
+    my $query = _GDT->mkquery_raw(qname => $args{qname}, id => 1234, edns_opts => $args{edns_opts});
+    my $res_raw = _GDT->query_raw($query, tcp => $args{tcp});
+
+    my $got = { rcode => undef, addr => undef, opts => undef };
+    if(defined $res_raw) {
+        my $res = eval { _GDT->parse_raw_response($res_raw) };
+        if($res) {
+            my ($ans) = Net::DNS::Packet->new(\$res_raw)->answer;
+            $got = {
+                rcode => $res->{rcode},
+                addr => $ans ? $ans->address : undef,
+                opts => $res->{opt_options},
+            };
+        }
+    }
+    Test::More::is_deeply($got, {
+        rcode => $args{rcode} || 0,
+        addr => $args{addr},
+        opts => $args{resp_opts},
+    }, $args{desc});
+
+    _GDT->test_stats();
+}
+
+test_keepalive(
+    desc => 'keepalive over TCP gets the current timeout',
+    tcp => 1, qname => 'static.example.com',
+    edns_opts => [ [ $KEEPALIVE, '' ] ],
+    addr => '192.0.2.1',
+    resp_opts => [ $keepalive_resp ],
+    stats => [qw/tcp_reqs edns noerror/],
+);
+
+test_keepalive(
+    desc => 'keepalive over UDP is ignored',
+    tcp => 0, qname => 'static.example.com',
+    edns_opts => [ [ $KEEPALIVE, '' ] ],
+    addr => '192.0.2.1',
+    resp_opts => [],
+    stats => [qw/udp_reqs edns noerror/],
+);
+
+test_keepalive(
+    desc => 'keepalive with a timeout value from the client is FORMERR',
+    tcp => 1, qname => 'static.example.com',
+    edns_opts => [ [ $KEEPALIVE, pack('n', 100) ] ],
+    rcode => 1,
+    resp_opts => [],
+    stats => [qw/tcp_reqs edns formerr/],
+);
+
+test_keepalive(
+    desc => 'client-subnet then keepalive over TCP',
+    tcp => 1, qname => 'reflect-edns.example.com',
+    edns_opts => [ $clientsub_query, [ $KEEPALIVE, '' ] ],
+    addr => '192.0.2.0',
+    resp_opts => [ $clientsub_resp, $keepalive_resp ],
+    stats => [qw/tcp_reqs edns edns_clientsub noerror/],
+);
+
+test_keepalive(
+    desc => 'keepalive then client-subnet over TCP',
+    tcp => 1, qname => 'reflect-edns.example.com',
+    edns_opts => [ [ $KEEPALIVE, '' ], $clientsub_query ],
+    addr => '192.0.2.0',
+    resp_opts => [ $clientsub_resp, $keepalive_resp ],
+    stats => [qw/tcp_reqs edns edns_clientsub noerror/],
+);
+
+test_keepalive(
+    desc => 'client-subnet and keepalive over UDP',
+    tcp => 0, qname => 'reflect-edns.example.com',
+    edns_opts => [ $clientsub_query, [ $KEEPALIVE, '' ] ],
+    addr => '192.0.2.0',
+    resp_opts => [ $clientsub_resp ],
+    stats => [qw/udp_reqs edns edns_clientsub noerror/],
+);
+
+test_keepalive(
+    desc => 'client-subnet alone over TCP',
+    tcp => 1, qname => 'reflect-edns.example.com',
+    edns_opts => [ $clientsub_query ],
+    addr => '192.0.2.0',
+    resp_opts => [ $clientsub_resp ],
+    stats => [qw/tcp_reqs edns edns_clientsub noerror/],
+);
+
+_GDT->test_kill_daemon($pid);
@@ -0,0 +1,87 @@
+
+# Test Response Rate Limiting with a low rate and a burst of queries
+#  from a single source
+
+use _GDT ();
+use FindBin ();
+use File::Spec ();
+use IO::Socket::INET ();
+use Test::More tests => 12;
+
+my $NUM_QUERIES = 20;
+
+my $pid = _GDT->test_spawn_daemon(File::Spec->catfile($FindBin::Bin, 'gdnsd.conf'));
+
+# Sends all of the queries at once from a single socket, so that they
+#  all land on the same UDP thread (and thus RRL table), and returns
+#  whatever responses arrive, keyed on query ID.
+sub burst {
+    my @queries = @_;
+    my $sock = IO::Socket::INET->new(
+        PeerAddr => '127.0.0.1',
+        PeerPort => $_GDT::DNS_PORT,
+        Proto => 'udp',
+    ) or die "Cannot create query socket: $@";
+    send($sock, $_, 0) foreach @queries;
+
+    my %responses;
+    while(1) {
+        my $rin = '';
+        vec($rin, fileno($sock), 1) = 1;
+        last unless select($rin, undef, undef, 1);
+        my $res_raw;
+        last unless defined recv($sock, $res_raw, 65535, 0);
+        $responses{unpack('n', $res_raw)} = $res_raw;
+    }
+    close($sock);
+    return \%responses;
+}
+
+# The rate is 1/sec, so after the first answer every other response
+#  to the burst should be slipped, and the rest dropped
+my %queries = map { $_ => _GDT->mkquery_raw(qname => 'www.example.com', id => $_) } (1 .. $NUM_QUERIES);
+my $responses = burst(map { $queries{$_} } sort { $a <=> $b } keys %queries);
+_GDT->stats_inc(qw/udp_reqs noerror/) foreach (1 .. $NUM_QUERIES);
+_GDT->test_stats();
+
+my (@full, @slipped);
+foreach my $id (keys %$responses) {
+    my $res = _GDT->parse_raw_response($responses->{$id});
+    if($res->{tc}) { push(@slipped, $id) } else { push(@full, $id) }
+}
+
+my $counters = _GDT->get_counters(qw/rrl_drop rrl_slip/);
+ok($counters->{rrl_drop} > 0, 'some responses were dropped');
+ok($counters->{rrl_slip} > 0, 'some responses were slipped');
+is(scalar(@slipped), $counters->{rrl_slip}, 'slipped responses match rrl_slip');
+is(scalar(@full) + scalar(@slipped) + $counters->{rrl_drop}, $NUM_QUERIES, 'every query was answered, slipped, or dropped');
+
+# A slipped response is the header and question only, with QR and TC set
+my @bad_slips = grep {
+    my $res_raw = $responses->{$_};
+    my $res = _GDT->parse_raw_response($res_raw);
+    !($res->{flags} & 0x8000)
+        || $res->{rcode}
+        || $res->{qdcount} != 1 || $res->{ancount} || $res->{nscount} || $res->{arcount}
+        || substr($res_raw, 12) ne substr($queries{$_}, 12)
+} @slipped;
+is_deeply(\@bad_slips, [], 'slipped responses are header and question only, with TC set');
+
+# NOTIMP responses (here for opcode STATUS) are exempt from RRL
+my @notimp_queries = map { _GDT->mkquery_raw(qname => 'www.example.com', id => $_, opcode => 2) } (1 .. $NUM_QUERIES);
+my $notimp_responses = burst(@notimp_queries);
+_GDT->stats_inc(qw/udp_reqs notimp/) foreach (1 .. $NUM_QUERIES);
+is(scalar(grep { _GDT->parse_raw_response($_)->{rcode} == 4 } values %$notimp_responses), $NUM_QUERIES, 'every NOTIMP was sent');
+_GDT->test_stats();
+_GDT->test_counters(%$counters);
+
+# ... as are TCP responses
+_GDT->test_dns(
+    v4_only => 1,
+    resopts => { usevc => 1 },
+    qname => 'www.example.com', qtype => 'A',
+    answer => 'www.example.com 86400 A 192.0.2.1',
+    stats => [qw/tcp_reqs noerror/],
+);
+
+_GDT->test_kill_daemon($pid);
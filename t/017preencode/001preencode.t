@@ -0,0 +1,75 @@
+
+# Test that the responses pre-encoded by preencode_answers are
+#  byte-for-byte identical to those encoded at runtime, by collecting
+#  every distinct response to a set of queries from a daemon without
+#  preencode_answers (gdnsd.conf) and one with it (gdnsd2.conf).
+
+use _GDT ();
+use FindBin ();
+use File::Spec ();
+use Test::More tests => 22;
+
+# Enough repetitions to see every rotation of the rotated rrsets
+my $REPS = 60;
+
+my @queries = (
+    [ 'rot.example.com',    1 ],       # rotated A
+    [ 'rot.example.com',    28 ],      # rotated AAAA
+    [ 'rot.example.com',    1, 1 ],    # ... with EDNS
+    [ 'rot.example.com',    16 ],      # NODATA
+    [ 'example.com',        2 ],       # rotated NS, with glue
+    [ 'mx.example.com',     15 ],      # MX with additionals
+    [ 'mail1.example.com',  1 ],
+    [ 'bigmx.example.com',  15 ],      # trimmed additional section
+    [ 'bigmx.example.com',  15, 1 ],   # ... but not with EDNS
+    [ 'alias.example.com',  1 ],       # CNAME chain
+    [ 'alias2.example.com', 28 ],
+    [ 'dynmx.example.com',  15 ],      # DYNA additional
+);
+
+# Returns, for each query in @queries, a hash of every distinct
+#  response seen over $REPS tries
+sub collect_responses {
+    my @rv;
+    foreach my $q (@queries) {
+        my ($qname, $qtype, $edns) = @$q;
+        my $query = _GDT->mkquery_raw(qname => $qname, qtype => $qtype, id => 4321, edns_opts => $edns ? [] : undef);
+        my %seen;
+        foreach (1 .. $REPS) {
+            _GDT->stats_inc($edns ? qw/udp_reqs edns noerror/ : qw/udp_reqs noerror/);
+            my $res_raw = _GDT->query_raw($query);
+            $seen{defined $res_raw ? unpack('H*', $res_raw) : 'no response'} = 1;
+        }
+        push(@rv, \%seen);
+    }
+    return \@rv;
+}
+
+my $pid = _GDT->test_spawn_daemon(File::Spec->catfile($FindBin::Bin, 'gdnsd.conf'));
+my $live = collect_responses();
+_GDT->test_stats();
+_GDT->test_kill_daemon($pid);
+
+is(scalar(keys %{$live->[0]}), 3, 'live rotated A has 3 variants');
+is(scalar(keys %{$live->[1]}), 2, 'live rotated AAAA has 2 variants');
+my ($trimmed) = keys %{$live->[7]};
+my ($untrimmed) = keys %{$live->[8]};
+ok(_GDT->parse_raw_response(pack('H*', $trimmed))->{arcount} < _GDT->parse_raw_response(pack('H*', $untrimmed))->{arcount} - 1,
+    'bigmx additional section is trimmed without EDNS');
+
+$pid = _GDT->test_spawn_daemon(File::Spec->catfile($FindBin::Bin, 'gdnsd2.conf'));
+my $preencoded = collect_responses();
+_GDT->test_stats();
+_GDT->test_kill_daemon($pid);
+
+my $gdout = '';
+if(open(my $gdout_fh, '<', $_GDT::OUTDIR . '/gdnsd.out')) {
+    local $/;
+    $gdout = <$gdout_fh>;
+    close($gdout_fh);
+}
+ok($gdout =~ /pre-encoded ([0-9]+) static responses/ && $1 > 0, 'responses were pre-encoded');
+
+foreach my $i (0 .. $#queries) {
+    is_deeply($preencoded->[$i], $live->[$i], "pre-encoded matches live: @{$queries[$i]}");
+}
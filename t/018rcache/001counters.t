@@ -0,0 +1,104 @@
+
+# Test which answers are served from the response cache, via the
+#  rcache_hit and rcache_miss stats.  Every query here is sent twice.
+#  Each IPv4 and IPv6 listener has its own I/O thread and cache.
+
+use _GDT ();
+use FindBin ();
+use File::Spec ();
+use Test::More tests => 16;
+
+my $fams = $_GDT::HAVE_V6 ? 2 : 1;
+my %rcache = (rcache_hit => 0, rcache_miss => 0);
+
+sub expect_rcache {
+    my ($hits, $misses) = @_;
+    local $Test::Builder::Level = $Test::Builder::Level + 1;
+    $rcache{rcache_hit} += $hits * $fams;
+    $rcache{rcache_miss} += $misses * $fams;
+    _GDT->test_counters(%rcache);
+}
+
+my $optrr = Net::DNS::RR->new(
+    type => "OPT",
+    ednsversion => 0,
+    name => "",
+    class => 1280,
+    extendedrcode => 0,
+    ednsflags => 0,
+);
+
+my $txt_answers = [
+    'txt.example.com 86400 TXT "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"',
+    'txt.example.com 86400 TXT "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb"',
+    'txt.example.com 86400 TXT "cccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccc"',
+];
+
+my $pid = _GDT->test_spawn_daemon(File::Spec->catfile($FindBin::Bin, 'gdnsd.conf'));
+
+_GDT->test_dns(
+    rep => 2,
+    qname => 'www.example.com', qtype => 'A',
+    answer => 'www.example.com 86400 A 192.0.2.1',
+);
+expect_rcache(1, 1);
+
+# The maximum response size is part of the key, so
+#  EDNS queries don't share entries with the above
+_GDT->test_dns(
+    rep => 2,
+    resopts => { udppacketsize => 1280 },
+    qname => 'www.example.com', qtype => 'A',
+    answer => 'www.example.com 86400 A 192.0.2.1',
+    addtl => $optrr,
+    stats => [qw/udp_reqs edns noerror/],
+);
+expect_rcache(1, 1);
+
+# Truncation is replayed from the cache ...
+_GDT->test_dns(
+    rep => 2,
+    resopts => { usevc => 0, igntc => 1, udppacketsize => 512 },
+    qname => 'txt.example.com', qtype => 'TXT',
+    header => { tc => 1 },
+    stats => [qw/udp_reqs udp_tc noerror/],
+);
+expect_rcache(1, 1);
+
+# ... but doesn't leak to queries with room for the full answer
+_GDT->test_dns(
+    rep => 2,
+    resopts => { usevc => 0, igntc => 1, udppacketsize => 1280 },
+    qname => 'txt.example.com', qtype => 'TXT',
+    answer => $txt_answers,
+    addtl => $optrr,
+    stats => [qw/udp_reqs edns udp_edns_big noerror/],
+);
+expect_rcache(1, 1);
+
+_GDT->test_dns(
+    rep => 2,
+    qname => 'nx.example.com', qtype => 'A',
+    header => { rcode => 'NXDOMAIN' },
+    auth => 'example.com 86400 SOA ns1.example.com hostmaster.example.com 1 7200 1800 259200 900',
+    stats => [qw/udp_reqs nxdomain/],
+);
+expect_rcache(1, 1);
+
+_GDT->test_dns(
+    rep => 2,
+    qname => 'example.org', qtype => 'A',
+    header => { rcode => 'REFUSED', aa => 0 },
+    stats => [qw/udp_reqs refused/],
+);
+expect_rcache(1, 1);
+
+# Dynamic answers are never cached
+_GDT->test_dns(
+    rep => 2,
+    qname => 'dyn.example.com', qtype => 'A',
+    answer => 'dyn.example.com 86400 A 192.0.2.99',
+);
+expect_rcache(0, 2);
+
+_GDT->test_kill_daemon($pid);
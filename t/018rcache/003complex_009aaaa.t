@@ -0,0 +1,16 @@
+
+# Rerun 003complex/009aaaa.t with response_cache_size, asking
+#  every query twice so that the second is answered from the cache
+
+use _GDT ();
+use FindBin ();
+use File::Spec ();
+
+$_GDT::EXTRA_OPTIONS = 'response_cache_size = 64';
+$_GDT::QUERY_REPS = 2;
+
+{
+    local $FindBin::Bin = File::Spec->catdir($FindBin::Bin, File::Spec->updir(), '003complex');
+    do File::Spec->catfile($FindBin::Bin, '009aaaa.t');
+    die $@ if $@;
+}
@@ -0,0 +1,134 @@
+
+# Test the cache of dynamic plugin results (dynamic_cache_size), via the
+#  dyncache_hit and dyncache_miss stats.  All queries here are IPv4, so
+#  they share one I/O thread and cache.
+
+use _GDT ();
+use FindBin ();
+use File::Spec ();
+use IO::Socket::INET ();
+use Test::More tests => 20;
+
+my %dyncache = (dyncache_hit => 0, dyncache_miss => 0);
+
+sub expect_dyncache {
+    my ($hits, $misses) = @_;
+    local $Test::Builder::Level = $Test::Builder::Level + 1;
+    $dyncache{dyncache_hit} += $hits;
+    $dyncache{dyncache_miss} += $misses;
+    _GDT->test_counters(%dyncache);
+}
+
+# Something for the tcp_connect monitor of simplefo's secondary to find
+my $listener = IO::Socket::INET->new(
+    LocalAddr => '127.0.0.1',
+    LocalPort => $_GDT::EXTRA_PORT,
+    Proto => 'tcp',
+    Listen => 128,
+    ReuseAddr => 1,
+);
+if(!$listener) { diag "Cannot listen on port $_GDT::EXTRA_PORT: $@"; BAIL_OUT($@); }
+
+my $pid = _GDT->test_spawn_daemon(File::Spec->catfile($FindBin::Bin, 'gdnsd.conf'));
+
+_GDT->test_dns(
+    v4_only => 1, rep => 2,
+    qname => 'st.example.com', qtype => 'A',
+    answer => 'st.example.com 86400 A 192.0.2.99',
+);
+expect_dyncache(1, 1);
+
+# Results are cached per client address
+SKIP: {
+    my $src_test = IO::Socket::INET->new(LocalAddr => '127.0.0.2', Proto => 'udp');
+    skip("Cannot bind to 127.0.0.2", 4) unless $src_test;
+    close($src_test);
+
+    _GDT->test_dns(
+        v4_only => 1, rep => 2,
+        resopts => { srcaddr => '127.0.0.2' },
+        qname => 'st.example.com', qtype => 'A',
+        answer => 'st.example.com 86400 A 192.0.2.99',
+    );
+    expect_dyncache(1, 1);
+
+    _GDT->test_dns(
+        v4_only => 1,
+        qname => 'st.example.com', qtype => 'A',
+        answer => 'st.example.com 86400 A 192.0.2.99',
+    );
+    expect_dyncache(1, 0);
+}
+
+# ... and edns-client-subnet source mask, and shared by other client
+#  subnets within the scope of the result (always 0 for static)
+_GDT->test_dns(
+    v4_only => 1, rep => 2,
+    qname => 'st.example.com', qtype => 'A',
+    q_optrr => _GDT::optrr_clientsub(addr_v4 => '192.0.2.0', src_mask => 24),
+    answer => 'st.example.com 86400 A 192.0.2.99',
+    addtl => _GDT::optrr_clientsub(addr_v4 => '192.0.2.0', src_mask => 24, scope_mask => 0),
+    stats => [qw/udp_reqs edns edns_clientsub noerror/],
+);
+expect_dyncache(1, 1);
+
+_GDT->test_dns(
+    v4_only => 1,
+    qname => 'st.example.com', qtype => 'A',
+    q_optrr => _GDT::optrr_clientsub(addr_v4 => '192.0.3.0', src_mask => 24),
+    answer => 'st.example.com 86400 A 192.0.2.99',
+    addtl => _GDT::optrr_clientsub(addr_v4 => '192.0.3.0', src_mask => 24, scope_mask => 0),
+    stats => [qw/udp_reqs edns edns_clientsub noerror/],
+);
+expect_dyncache(1, 0);
+
+_GDT->test_dns(
+    v4_only => 1,
+    qname => 'st.example.com', qtype => 'A',
+    q_optrr => _GDT::optrr_clientsub(addr_v4 => '192.0.2.0', src_mask => 25),
+    answer => 'st.example.com 86400 A 192.0.2.99',
+    addtl => _GDT::optrr_clientsub(addr_v4 => '192.0.2.0', src_mask => 25, scope_mask => 0),
+    stats => [qw/udp_reqs edns edns_clientsub noerror/],
+);
+expect_dyncache(0, 1);
+
+# reflect doesn't declare its results cacheable
+_GDT->test_dns(
+    v4_only => 1, rep => 2,
+    qname => 'refl.example.com', qtype => 'A',
+    answer => 'refl.example.com 60 A 127.0.0.1',
+);
+expect_dyncache(0, 0);
+
+# simplefo's primary is always down, and the secondary is up
+_GDT->test_dns(
+    v4_only => 1, rep => 2,
+    qname => 'fo.example.com', qtype => 'A',
+    answer => 'fo.example.com 60 A 127.0.0.1',
+);
+expect_dyncache(1, 1);
+
+# Once the secondary goes down too, simplefo falls back to the primary,
+#  which only shows up before dynamic_cache_secs if the monitoring state
+#  change invalidated the cached result
+close($listener);
+my $failed_over = 0;
+foreach my $try (1 .. 60) {
+    _GDT->stats_inc(qw/udp_reqs noerror/);
+    my $res = _GDT->get_resolver()->send('fo.example.com', 'A');
+    my ($rr) = $res ? $res->answer : ();
+    if($rr && $rr->address eq '192.0.2.1') {
+        $failed_over = 1;
+        last;
+    }
+    select(undef, undef, undef, 0.5);
+}
+ok($failed_over, 'cached result was invalidated by monitoring state change');
+
+_GDT->test_dns(
+    v4_only => 1,
+    qname => 'fo.example.com', qtype => 'A',
+    answer => 'fo.example.com 60 A 192.0.2.1',
+);
+
+_GDT->test_kill_daemon($pid);
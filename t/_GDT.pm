@@ -133,6 +133,12 @@ else {
 
 our $RAND_LOOPS = $ENV{GDNSD_RTEST_LOOPS} || 100;
 
+# For test files which rerun another directory's tests under different
+#  settings: text inserted at the top of the options stanza of every
+#  config spawn_daemon() runs, and the minimum "rep" for test_dns()
+our $EXTRA_OPTIONS = '';
+our $QUERY_REPS = 1;
+
 die "Cannot run testsuite as root" if ! $>;
 
 my $CSV_TEMPLATE = 
@@ -142,8 +148,8 @@ my $CSV_TEMPLATE =
     . "([0-9]+),([0-9]+),([0-9]+),([0-9]+),([0-9]+),([0-9]+),([0-9]+),([0-9]+),([0-9]+),([0-9]+)\r\n"
     . "udp_reqs,udp_recvfail,udp_sendfail,udp_tc,udp_edns_big,udp_edns_tc\r\n"
     . "([0-9]+),([0-9]+),([0-9]+),([0-9]+),([0-9]+),([0-9]+)\r\n"
-    . "tcp_reqs,tcp_recvfail,tcp_recvsize,tcp_sendfail\r\n"
-    . "([0-9]+),([0-9]+),([0-9]+),([0-9]+)\r\n";
+    . "tcp_reqs,tcp_recvfail,tcp_recvsize,tcp_sendfail,tcp_evicted\r\n"
+    . "([0-9]+),([0-9]+),([0-9]+),([0-9]+),([0-9]+)\r\n";
 
 my %stats_accum = (
     noerror      => 0,
@@ -165,6 +171,7 @@ my %stats_accum = (
     tcp_recvfail => 0,
     tcp_recvsize => 0,
     tcp_sendfail => 0,
+    tcp_evicted  => 0,
 );
 
 my $_useragent;
@@ -213,6 +220,7 @@ sub check_stats_inner {
         tcp_recvfail    => $19,
         tcp_recvsize    => $20,
         tcp_sendfail    => $21,
+        tcp_evicted     => $22,
     };
 
     ## use Data::Dumper; warn Dumper($csv_vals);
@@ -281,6 +289,7 @@ sub spawn_daemon {
         s/\@cfdir\@/$cfdir/g;
         s/\@pluginpath\@/$PLUGIN_PATH/g;
         print $out_fh $_;
+        print $out_fh "  $EXTRA_OPTIONS\n" if $EXTRA_OPTIONS && /^options\s*=>\s*\{/;
     }
     close($orig_fh) or die "Cannot close test configfile '$cfgfile': $!";
     close($out_fh) or die "Cannot close test config text output file '$cfgout': $!";
@@ -764,6 +773,7 @@ sub test_dns {
     $args{wrr_v4}   ||= {};
     $args{wrr_v6}   ||= {};
     $args{rep}      ||= 1;
+    $args{rep} = $QUERY_REPS if $args{rep} < $QUERY_REPS;
 
     foreach my $sec (qw/answer auth addtl/) {
         my $aref;
@@ -905,5 +915,157 @@ sub optrr_clientsub {
     );
 }
 
+# Fetches the current values of the named counters from the daemon's
+#  CSV stats output, including those which check_stats() doesn't track.
+sub get_counters {
+    my ($class, @names) = @_;
+    my @lines = split(/\r\n/, _get_daemon_csv_stats());
+    my %csv_vals;
+    foreach my $i (0 .. $#lines - 1) {
+        next unless $lines[$i] =~ /^[a-z0-9_,]+$/ && $lines[$i + 1] =~ /^[0-9,]+$/;
+        my @keys = split(/,/, $lines[$i]);
+        my @vals = split(/,/, $lines[$i + 1]);
+        next unless @keys == @vals;
+        @csv_vals{@keys} = @vals;
+    }
+    foreach my $name (@names) {
+        die "Counter $name not found in CSV stats" unless defined $csv_vals{$name};
+    }
+    return { map { $_ => $csv_vals{$_} } @names };
+}
+
+# As check_stats(), but for arbitrary counters from get_counters()
+sub check_counters {
+    my ($class, %to_check) = @_;
+    my $attempts = 0;
+    while(1) {
+        my $got = $class->get_counters(keys %to_check);
+        my @soft;
+        foreach my $name (keys %to_check) {
+            next if $got->{$name} == $to_check{$name};
+            die "Counters check failed: $name mismatch (hard-fail), wanted $to_check{$name}, got $got->{$name}"
+                if $got->{$name} > $to_check{$name};
+            push(@soft, "$name mismatch (soft-fail), wanted $to_check{$name}, got $got->{$name}");
+        }
+        return unless @soft;
+        die "Counters check failed: " . join('; ', @soft) if $attempts++ >= 10;
+        select(undef, undef, undef, 0.1 * $attempts);
+    }
+}
+
+sub test_counters {
+    my ($class, %to_check) = @_;
+    local $Test::Builder::Level = $Test::Builder::Level + 1;
+    eval { $class->check_counters(%to_check) };
+    Test::More::ok(!$@) or Test::More::diag($@);
+}
+
+# Builds a raw query packet, for tests which need control over the
+#  wire format beyond what Net::DNS offers (e.g. multiple EDNS options).
+#  Args: qname, qtype (numeric, default 1), id, opcode, and edns_opts as
+#  an arrayref of [ code, data ] pairs.  An empty edns_opts still adds
+#  an OPT RR, without any options.
+sub mkquery_raw {
+    my ($class, %args) = @_;
+    my $qname_wire = '';
+    $qname_wire .= pack('C/a*', $_) foreach (split(/\./, $args{qname}));
+    $qname_wire .= "\0";
+    my $pkt = pack('nnnnnn', $args{id} || 0, ($args{opcode} || 0) << 11, 1, 0, 0, $args{edns_opts} ? 1 : 0)
+        . $qname_wire . pack('nn', $args{qtype} || 1, 1);
+    if($args{edns_opts}) {
+        my $rdata = join('', map { pack('nn/a*', $_->[0], $_->[1]) } @{$args{edns_opts}});
+        $pkt .= "\0" . pack('nnNn/a*', 41, 1280, 0, $rdata);
+    }
+    return $pkt;
+}
+
+# Sends a raw query packet (from mkquery_raw() or elsewhere) and returns
+#  the raw response, or undef if none arrived before the timeout.
+#  Args: tcp => bool, v6 => bool, timeout => secs (default 3)
+sub query_raw {
+    my ($class, $qpacket_raw, %args) = @_;
+    my $timeout = $args{timeout} || 3;
+    my $sockclass = $args{v6} ? 'IO::Socket::INET6' : 'IO::Socket::INET';
+    my $sock = $sockclass->new(
+        PeerAddr => $args{v6} ? '::1' : '127.0.0.1',
+        PeerPort => $DNS_PORT,
+        Proto => $args{tcp} ? 'tcp' : 'udp',
+        Timeout => 10,
+    ) or die "Cannot create query socket: $@";
+
+    my $res_raw;
+    if($args{tcp}) {
+        send($sock, pack('n/a*', $qpacket_raw), 0);
+        my $buf = '';
+        my $want = 2;
+        while(length($buf) < $want) {
+            my $rin = '';
+            vec($rin, fileno($sock), 1) = 1;
+            last unless select($rin, undef, undef, $timeout);
+            last unless sysread($sock, $buf, 65537, length($buf));
+            $want = 2 + unpack('n', $buf) if length($buf) >= 2;
+        }
+        $res_raw = substr($buf, 2) if length($buf) >= 2 && length($buf) == $want;
+    }
+    else {
+        send($sock, $qpacket_raw, 0);
+        my $rin = '';
+        vec($rin, fileno($sock), 1) = 1;
+        recv($sock, $res_raw, 65535, 0) if select($rin, undef, undef, $timeout);
+    }
+    close($sock);
+    return $res_raw;
+}
+
+# Decodes just enough of a raw response for tests of the parts Net::DNS
+#  hides from us: header fields and section counts, the length of the
+#  question section, and the rdata of the OPT RR (opt_rdata, undef if
+#  there isn't one) split into an arrayref of [ code, data ] options
+#  (opt_options).
+sub parse_raw_response {
+    my ($class, $res_raw) = @_;
+    my %res;
+    @res{qw/id flags qdcount ancount nscount arcount/} = unpack('nnnnnn', $res_raw);
+    $res{tc} = ($res{flags} >> 9) & 1;
+    $res{rcode} = $res{flags} & 0xF;
+
+    my $offset = 12;
+    my $skip_name = sub {
+        while(1) {
+            my $len = unpack('C', substr($res_raw, $offset, 1));
+            if(($len & 0xC0) == 0xC0) { $offset += 2; return; }
+            $offset += 1 + $len;
+            return unless $len;
+        }
+    };
+
+    foreach (1 .. $res{qdcount}) {
+        $skip_name->();
+        $offset += 4;
+    }
+    $res{question_end} = $offset;
+
+    foreach (1 .. $res{ancount} + $res{nscount} + $res{arcount}) {
+        $skip_name->();
+        my ($type, undef, undef, $rdlen) = unpack('nnNn', substr($res_raw, $offset, 10));
+        $offset += 10;
+        if($type == 41) {
+            $res{opt_rdata} = substr($res_raw, $offset, $rdlen);
+            my @opts;
+            my $rdata = $res{opt_rdata};
+            while(length($rdata) >= 4) {
+                my ($code, $data) = unpack('nn/a*', $rdata);
+                push(@opts, [ $code, $data ]);
+                substr($rdata, 0, 4 + length($data), '');
+            }
+            $res{opt_options} = \@opts;
+        }
+        $offset += $rdlen;
+    }
+    die "Response has trailing garbage" if $offset != length($res_raw);
+
+    return \%res;
+}
+
 END { kill(9, $saved_pid) if $saved_pid; }
 1;